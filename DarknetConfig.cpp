@@ -0,0 +1,213 @@
+#include <fstream>
+#include <algorithm>
+#include "DarknetConfig.h"
+#include "Main/CoreTools.hpp"
+
+//-----------------------------------//
+//----- CDarknetConfig::Section -----//
+//-----------------------------------//
+CDarknetConfig::Section::Section(const std::string &type)
+{
+    m_type = type;
+}
+
+bool CDarknetConfig::Section::has(const std::string &key) const
+{
+    auto it = std::find_if(m_options.begin(), m_options.end(), [&key](const std::pair<std::string, std::string>& option)
+    {
+        return option.first == key;
+    });
+    return it != m_options.end();
+}
+
+std::string CDarknetConfig::Section::get(const std::string &key, const std::string &defaultValue) const
+{
+    for(auto&& option : m_options)
+    {
+        if(option.first == key)
+            return option.second;
+    }
+    return defaultValue;
+}
+
+int CDarknetConfig::Section::getInt(const std::string &key, int defaultValue) const
+{
+    auto value = get(key);
+    if(value.empty())
+        return defaultValue;
+
+    return std::stoi(value);
+}
+
+float CDarknetConfig::Section::getFloat(const std::string &key, float defaultValue) const
+{
+    auto value = get(key);
+    if(value.empty())
+        return defaultValue;
+
+    return std::stof(value);
+}
+
+std::vector<int> CDarknetConfig::Section::getInts(const std::string &key) const
+{
+    std::vector<int> values;
+    std::vector<std::string> tokens;
+    Utils::String::tokenize(get(key), tokens, ",");
+
+    for(auto&& token : tokens)
+    {
+        if(token.find_first_not_of(" \t") != std::string::npos)
+            values.push_back(std::stoi(token));
+    }
+    return values;
+}
+
+std::vector<float> CDarknetConfig::Section::getFloats(const std::string &key) const
+{
+    std::vector<float> values;
+    std::vector<std::string> tokens;
+    Utils::String::tokenize(get(key), tokens, ",");
+
+    for(auto&& token : tokens)
+    {
+        if(token.find_first_not_of(" \t") != std::string::npos)
+            values.push_back(std::stof(token));
+    }
+    return values;
+}
+
+void CDarknetConfig::Section::set(const std::string &key, const std::string &value)
+{
+    for(auto&& option : m_options)
+    {
+        if(option.first == key)
+        {
+            option.second = value;
+            return;
+        }
+    }
+    m_options.push_back(std::make_pair(key, value));
+}
+
+//--------------------------//
+//----- CDarknetConfig -----//
+//--------------------------//
+CDarknetConfig::CDarknetConfig(const std::string &path)
+{
+    load(path);
+}
+
+void CDarknetConfig::load(const std::string &path)
+{
+    std::ifstream file(path);
+    if(!file.is_open())
+        throw CException(CoreExCode::INVALID_FILE, "Unable to read darknet config file: " + path, __func__, __FILE__, __LINE__);
+
+    m_net = Section();
+    m_layers.clear();
+
+    auto trim = [](const std::string& str)
+    {
+        auto first = str.find_first_not_of(" \t\r");
+        if(first == std::string::npos)
+            return std::string();
+
+        auto last = str.find_last_not_of(" \t\r");
+        return str.substr(first, last - first + 1);
+    };
+
+    Section* pCurrent = nullptr;
+    std::string line;
+
+    while(std::getline(file, line))
+    {
+        line = trim(line);
+        if(line.empty() || line[0] == '#' || line[0] == ';')
+            continue;
+
+        if(line[0] == '[')
+        {
+            auto type = line.substr(1, line.find(']') - 1);
+            if(type == "net" || type == "network")
+            {
+                m_net = Section(type);
+                pCurrent = &m_net;
+            }
+            else
+            {
+                m_layers.push_back(Section(type));
+                pCurrent = &m_layers.back();
+            }
+        }
+        else
+        {
+            auto pos = line.find('=');
+            if(pos == std::string::npos || pCurrent == nullptr)
+                throw CException(CoreExCode::INVALID_FILE, "Invalid darknet config line: " + line, __func__, __FILE__, __LINE__);
+
+            pCurrent->m_options.push_back(std::make_pair(trim(line.substr(0, pos)), trim(line.substr(pos + 1))));
+        }
+    }
+
+    if(m_net.m_type.empty())
+        throw CException(CoreExCode::INVALID_FILE, "Missing [net] section in darknet config file: " + path, __func__, __FILE__, __LINE__);
+}
+
+void CDarknetConfig::save(const std::string &path) const
+{
+    std::ofstream file(path, std::ios::out | std::ios::trunc);
+    if(!file.is_open())
+        throw CException(CoreExCode::INVALID_FILE, "Unable to write darknet config file: " + path, __func__, __FILE__, __LINE__);
+
+    auto writeSection = [&file](const Section& section)
+    {
+        file << "[" << section.m_type << "]\n";
+        for(auto&& option : section.m_options)
+            file << option.first << "=" << option.second << "\n";
+
+        file << "\n";
+    };
+
+    writeSection(m_net);
+    for(auto&& layer : m_layers)
+        writeSection(layer);
+}
+
+CDarknetConfig::Section &CDarknetConfig::getNet()
+{
+    return m_net;
+}
+
+const CDarknetConfig::Section &CDarknetConfig::getNet() const
+{
+    return m_net;
+}
+
+size_t CDarknetConfig::getLayerCount() const
+{
+    return m_layers.size();
+}
+
+CDarknetConfig::Section &CDarknetConfig::getLayer(size_t index)
+{
+    return m_layers.at(index);
+}
+
+const CDarknetConfig::Section &CDarknetConfig::getLayer(size_t index) const
+{
+    return m_layers.at(index);
+}
+
+std::vector<int> CDarknetConfig::getLayerRefs(size_t index, const std::string &key) const
+{
+    auto refs = m_layers.at(index).getInts(key);
+    for(auto&& ref : refs)
+    {
+        if(ref < 0)
+            ref += (int)index;
+
+        if(ref < 0 || ref >= (int)m_layers.size())
+            throw CException(CoreExCode::INVALID_FILE, "Invalid layer reference in darknet config file.", __func__, __FILE__, __LINE__);
+    }
+    return refs;
+}
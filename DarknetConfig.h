@@ -0,0 +1,61 @@
+#ifndef DARKNETCONFIG_H
+#define DARKNETCONFIG_H
+
+#include <string>
+#include <vector>
+#include "YoloTrainGlobal.hpp"
+
+//--------------------------//
+//----- CDarknetConfig -----//
+//--------------------------//
+// Darknet network description (.cfg) as an ordered list of sections.
+// Layer indices follow darknet convention: the [net] section is not counted.
+class YOLOTRAIN_EXPORT CDarknetConfig
+{
+    public:
+
+        class Section
+        {
+            public:
+
+                Section() = default;
+                Section(const std::string& type);
+
+                bool                has(const std::string& key) const;
+
+                std::string         get(const std::string& key, const std::string& defaultValue = "") const;
+                int                 getInt(const std::string& key, int defaultValue) const;
+                float               getFloat(const std::string& key, float defaultValue) const;
+                std::vector<int>    getInts(const std::string& key) const;
+                std::vector<float>  getFloats(const std::string& key) const;
+
+                void                set(const std::string& key, const std::string& value);
+
+            public:
+
+                std::string                                         m_type;
+                std::vector<std::pair<std::string, std::string>>    m_options;
+        };
+
+        CDarknetConfig() = default;
+        CDarknetConfig(const std::string& path);
+
+        void                load(const std::string& path);
+        void                save(const std::string& path) const;
+
+        Section&            getNet();
+        const Section&      getNet() const;
+        size_t              getLayerCount() const;
+        Section&            getLayer(size_t index);
+        const Section&      getLayer(size_t index) const;
+
+        // Convert relative layer references (route, shortcut...) to absolute indices
+        std::vector<int>    getLayerRefs(size_t index, const std::string& key) const;
+
+    private:
+
+        Section                 m_net;
+        std::vector<Section>    m_layers;
+};
+
+#endif // DARKNETCONFIG_H
@@ -0,0 +1,266 @@
+#include <fstream>
+#include <mutex>
+#include <vector>
+#include <cmath>
+#include <random>
+#include <boost/filesystem.hpp>
+#include "darknet.h"
+#include "DarknetEngine.h"
+#include "Main/CoreTools.hpp"
+
+// Exported by libdarknet but not declared in darknet.h
+extern "C" void copy_weights_net(network net_train, network* net_map);
+
+namespace
+{
+    std::mutex _darknetMutex;
+
+    // Darknet C API takes non-const strings
+    std::vector<char> toCString(const std::string& str)
+    {
+        return std::vector<char>(str.c_str(), str.c_str() + str.size() + 1);
+    }
+
+    // Same as darknet rand_scale(): uniform in [1, s], inverted one time out of two
+    float randomScale(float s)
+    {
+        static std::mt19937 generator(std::random_device{}());
+        float scale = std::uniform_real_distribution<float>(1.0f, s)(generator);
+        return generator() % 2 ? scale : 1.0f / scale;
+    }
+}
+
+//--------------------------//
+//----- CDarknetEngine -----//
+//--------------------------//
+CDarknetEngine::CDarknetEngine(const std::string &dataPath, const std::string &trainListPath, const std::string &cfgPath, const std::string &weightsPath)
+{
+    m_dataPath = dataPath;
+    m_trainListPath = trainListPath;
+    m_cfgPath = cfgPath;
+    m_weightsPath = weightsPath;
+    m_backupFolder = boost::filesystem::path(cfgPath).parent_path().string();
+}
+
+void CDarknetEngine::setBackupFolder(const std::string &folder)
+{
+    m_backupFolder = folder;
+}
+
+void CDarknetEngine::setMapPeriod(int epochs)
+{
+    m_mapPeriod = epochs;
+}
+
+void CDarknetEngine::setSavePeriod(int iterations)
+{
+    m_savePeriod = std::max(0, iterations);
+}
+
+void CDarknetEngine::setIterationCallback(const IterationCallback &callback)
+{
+    m_callback = callback;
+}
+
+void CDarknetEngine::train(const std::atomic_bool &bStop)
+{
+    std::lock_guard<std::mutex> lock(_darknetMutex);
+
+    // Training image list: kept alive for the whole loop since darknet loader only stores pointers
+    std::ifstream trainFile(m_trainListPath);
+    if(!trainFile.is_open())
+        throw CException(CoreExCode::INVALID_FILE, "Unable to read training image list: " + m_trainListPath, __func__, __FILE__, __LINE__);
+
+    std::vector<std::vector<char>> imagePaths;
+    std::vector<char*> imagePathPtrs;
+    std::string line;
+
+    while(std::getline(trainFile, line))
+    {
+        if(!line.empty())
+            imagePaths.push_back(toCString(line));
+    }
+
+    if(imagePaths.empty())
+        throw CException(CoreExCode::INVALID_PARAMETER, "Empty training image list.", __func__, __FILE__, __LINE__);
+
+    for(auto&& path : imagePaths)
+        imagePathPtrs.push_back(path.data());
+
+    auto cfgPath = toCString(m_cfgPath);
+    auto weightsPath = toCString(m_weightsPath);
+    auto dataPath = toCString(m_dataPath);
+    network* pNet = load_network(cfgPath.data(), weightsPath.data(), 0);
+    network& net = *pNet;
+
+    // Dynamic mini-batch changes the batch size at each resize and relies on darknet multi-device bookkeeping
+    if(net.dynamic_minibatch)
+    {
+        free_network_ptr(pNet);
+        free(pNet);
+        throw CException(CoreExCode::NOT_IMPLEMENTED, "dynamic_minibatch is not supported by the darknet library engine, use the process engine.", __func__, __FILE__, __LINE__);
+    }
+
+    const std::string baseName = m_backupFolder + "/" + boost::filesystem::path(m_cfgPath).stem().string();
+    auto saveWeights = [&](const std::string& suffix)
+    {
+        auto path = toCString(baseName + "_" + suffix + ".weights");
+        save_weights(net, path.data());
+    };
+
+    // Same loader arguments as darknet train_detector() for a single device, chart and image display excepted
+    const int imageCount = net.batch * net.subdivisions;
+    layer lastLayer = net.layers[net.n - 1];
+    data buffer;
+    load_args args = {0};
+    args.w = net.w;
+    args.h = net.h;
+    args.c = net.c;
+    args.paths = imagePathPtrs.data();
+    args.n = imageCount;
+    args.m = (int)imagePathPtrs.size();
+    args.classes = lastLayer.classes;
+    args.flip = net.flip;
+    args.jitter = lastLayer.jitter;
+    args.resize = lastLayer.resize;
+    args.num_boxes = lastLayer.max_boxes;
+    args.truth_size = lastLayer.truth_size;
+    args.d = &buffer;
+    args.type = DETECTION_DATA;
+    args.threads = 64;
+    args.angle = net.angle;
+    args.gaussian_noise = net.gaussian_noise;
+    args.blur = net.blur;
+    args.mixup = net.mixup;
+    args.exposure = net.exposure;
+    args.saturation = net.saturation;
+    args.hue = net.hue;
+    args.letter_box = net.letter_box;
+    args.mosaic_bound = net.mosaic_bound;
+    args.contrastive = net.contrastive;
+    args.contrastive_jit_flip = net.contrastive_jit_flip;
+    args.contrastive_color = net.contrastive_color;
+
+    if(net.contrastive && args.threads > net.batch / 2)
+        args.threads = net.batch / 2;
+
+    if(net.track)
+    {
+        args.track = net.track;
+        args.augment_speed = net.augment_speed;
+        args.threads = net.sequential_subdivisions ? net.sequential_subdivisions : net.subdivisions;
+        args.mini_batch = net.batch / net.time_steps;
+    }
+
+    // mAP cadence in iterations, as darknet -mAP_epochs
+    int mapIterations = 0;
+    if(m_mapPeriod > 0)
+        mapIterations = std::max(100, m_mapPeriod * (int)imagePathPtrs.size() / imageCount);
+
+    int nextMapIteration = std::max(net.burn_in, mapIterations);
+
+    // mAP is computed on a separate network with batch=1 at config input size, as darknet train_detector():
+    // the training network has the training batch and the size of the last multi-scale resize
+    network* pMapNet = nullptr;
+    if(mapIterations > 0)
+        pMapNet = load_network_custom(cfgPath.data(), 0, 0, 1);
+
+    float avgLoss = -1.0f;
+    float bestMap = 0.0f;
+    const int initW = net.w;
+    const int initH = net.h;
+    int count = 0;
+    pthread_t loadThread = load_data(args);
+
+    while(get_current_batch(net) < net.max_batches && bStop == false)
+    {
+        // Multi-scale training (random=1): new input size every 10 iterations, as darknet train_detector()
+        if(lastLayer.random && count++ % 10 == 0)
+        {
+            const float randomCoef = lastLayer.random != 1.0f ? lastLayer.random : 1.4f;
+            const float scale = randomScale(randomCoef);
+            int w = (int)std::round(scale * initW / net.resize_step + 1) * net.resize_step;
+            int h = (int)std::round(scale * initH / net.resize_step + 1) * net.resize_step;
+
+            if(scale < 1 && (w > initW || h > initH))
+            {
+                w = initW;
+                h = initH;
+            }
+
+            // Largest size at the beginning (memory check) and at the end (rolling mean/variance)
+            if(avgLoss < 0 || get_current_batch(net) > net.max_batches - 100)
+            {
+                w = (int)std::round(randomCoef * initW / net.resize_step + 1) * net.resize_step;
+                h = (int)std::round(randomCoef * initH / net.resize_step + 1) * net.resize_step;
+            }
+
+            args.w = std::max(w, net.resize_step);
+            args.h = std::max(h, net.resize_step);
+
+            // Prefetched batch has the previous size
+            pthread_join(loadThread, 0);
+            free_data(buffer);
+            loadThread = load_data(args);
+            resize_network(pNet, args.w, args.h);
+        }
+
+        pthread_join(loadThread, 0);
+        data trainData = buffer;
+        loadThread = load_data(args);
+
+        float loss = train_network(net, trainData);
+        free_data(trainData);
+
+        if(avgLoss < 0 || std::isnan(avgLoss))
+            avgLoss = loss;
+
+        avgLoss = avgLoss * 0.9f + loss * 0.1f;
+        const int iteration = get_current_batch(net);
+        float map = -1.0f;
+
+        if(mapIterations > 0 && (iteration >= nextMapIteration || iteration == net.max_batches))
+        {
+            nextMapIteration = iteration + mapIterations;
+            copy_weights_net(net, pMapNet);
+            map = validate_detector_map(dataPath.data(), cfgPath.data(), weightsPath.data(), 0.25f, 0.5f, 0, net.letter_box, pMapNet);
+
+            if(map > bestMap)
+            {
+                bestMap = map;
+                saveWeights("best");
+            }
+        }
+
+        if(iteration % 100 == 0)
+            saveWeights("last");
+
+        bool bSave;
+        if(m_savePeriod > 0)
+            bSave = iteration % m_savePeriod == 0;
+        else
+            bSave = iteration % 10000 == 0 || (net.max_batches < 10000 && iteration % 1000 == 0);
+
+        if(bSave)
+            saveWeights(std::to_string(iteration));
+
+        if(m_callback)
+            m_callback(iteration, avgLoss, map, bestMap);
+    }
+
+    pthread_join(loadThread, 0);
+    free_data(buffer);
+
+    if(bStop)
+        saveWeights("last");
+    else
+        saveWeights("final");
+
+    if(pMapNet)
+    {
+        free_network_ptr(pMapNet);
+        free(pMapNet);
+    }
+    free_network_ptr(pNet);
+    free(pNet);
+}
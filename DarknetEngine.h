@@ -0,0 +1,45 @@
+#ifndef DARKNETENGINE_H
+#define DARKNETENGINE_H
+
+#include <atomic>
+#include <functional>
+#include <string>
+#include "YoloTrainGlobal.hpp"
+
+//--------------------------//
+//----- CDarknetEngine -----//
+//--------------------------//
+// Drive darknet detector training loop in-process through libdarknet.
+// Metrics are delivered by callback at each iteration and stop is cooperative:
+// current batch is completed and last weights are saved before returning.
+// Darknet relies on global state, so trainings are serialized within a process.
+class YOLOTRAIN_EXPORT CDarknetEngine
+{
+    public:
+
+        // Arguments: iteration, average loss, mAP@0.5 (-1 if not computed), best mAP@0.5
+        using IterationCallback = std::function<void(int, float, float, float)>;
+
+        CDarknetEngine(const std::string& dataPath, const std::string& trainListPath, const std::string& cfgPath, const std::string& weightsPath);
+
+        void    setBackupFolder(const std::string& folder);
+        void    setMapPeriod(int epochs);
+        // Numbered checkpoints period, 0 = same as darknet executable (1000 iterations, 10000 from 10000 max batches)
+        void    setSavePeriod(int iterations);
+        void    setIterationCallback(const IterationCallback& callback);
+
+        void    train(const std::atomic_bool& bStop);
+
+    private:
+
+        std::string         m_dataPath;
+        std::string         m_trainListPath;
+        std::string         m_cfgPath;
+        std::string         m_weightsPath;
+        std::string         m_backupFolder;
+        int                 m_mapPeriod = 0;
+        int                 m_savePeriod = 0;
+        IterationCallback   m_callback = nullptr;
+};
+
+#endif // DARKNETENGINE_H
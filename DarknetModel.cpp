@@ -0,0 +1,263 @@
+#include <fstream>
+#include "DarknetModel.h"
+#include "Main/CoreTools.hpp"
+
+//-------------------------//
+//----- CDarknetModel -----//
+//-------------------------//
+CDarknetModel::CDarknetModel(const std::string &cfgPath, const std::string &weightsPath)
+{
+    m_config.load(cfgPath);
+    updateShapes();
+    loadWeights(weightsPath);
+}
+
+void CDarknetModel::save(const std::string &cfgPath, const std::string &weightsPath) const
+{
+    m_config.save(cfgPath);
+
+    std::ofstream file(weightsPath, std::ios::out | std::ios::binary | std::ios::trunc);
+    if(!file.is_open())
+        throw CException(CoreExCode::INVALID_FILE, "Unable to write darknet weights file: " + weightsPath, __func__, __FILE__, __LINE__);
+
+    auto write = [&file](const std::vector<float>& values)
+    {
+        file.write(reinterpret_cast<const char*>(values.data()), values.size() * sizeof(float));
+    };
+
+    file.write(reinterpret_cast<const char*>(&m_major), sizeof(int32_t));
+    file.write(reinterpret_cast<const char*>(&m_minor), sizeof(int32_t));
+    file.write(reinterpret_cast<const char*>(&m_revision), sizeof(int32_t));
+
+    if(m_major * 10 + m_minor >= 2)
+        file.write(reinterpret_cast<const char*>(&m_seen), sizeof(uint64_t));
+    else
+    {
+        uint32_t seen = (uint32_t)m_seen;
+        file.write(reinterpret_cast<const char*>(&seen), sizeof(uint32_t));
+    }
+
+    for(size_t i=0; i<m_layers.size(); ++i)
+    {
+        if(m_config.getLayer(i).m_type != "convolutional")
+            continue;
+
+        const auto& layer = m_layers[i];
+        write(layer.m_biases);
+
+        if(!layer.m_scales.empty())
+        {
+            write(layer.m_scales);
+            write(layer.m_rollingMean);
+            write(layer.m_rollingVariance);
+        }
+        write(layer.m_weights);
+    }
+
+    if(!file.good())
+        throw CException(CoreExCode::INVALID_FILE, "Error while writing darknet weights file: " + weightsPath, __func__, __FILE__, __LINE__);
+}
+
+CDarknetConfig &CDarknetModel::getConfig()
+{
+    return m_config;
+}
+
+const CDarknetConfig &CDarknetModel::getConfig() const
+{
+    return m_config;
+}
+
+size_t CDarknetModel::getLayerCount() const
+{
+    return m_layers.size();
+}
+
+CDarknetModel::Layer &CDarknetModel::getLayer(size_t index)
+{
+    return m_layers.at(index);
+}
+
+const CDarknetModel::Layer &CDarknetModel::getLayer(size_t index) const
+{
+    return m_layers.at(index);
+}
+
+uint64_t CDarknetModel::getSeen() const
+{
+    return m_seen;
+}
+
+void CDarknetModel::setSeen(uint64_t seen)
+{
+    m_seen = seen;
+}
+
+void CDarknetModel::updateShapes()
+{
+    const auto& net = m_config.getNet();
+    int w = net.getInt("width", 416);
+    int h = net.getInt("height", 416);
+    int c = net.getInt("channels", 3);
+    m_layers.resize(m_config.getLayerCount());
+
+    for(size_t i=0; i<m_config.getLayerCount(); ++i)
+    {
+        const auto& section = m_config.getLayer(i);
+        auto& layer = m_layers[i];
+        layer.m_inW = w;
+        layer.m_inH = h;
+        layer.m_inC = c;
+
+        if(section.m_type == "convolutional")
+        {
+            int size = section.getInt("size", 1);
+            int stride = section.getInt("stride", 1);
+            int padding = section.getInt("pad", 0) ? size / 2 : section.getInt("padding", 0);
+            layer.m_outW = (w + 2*padding - size) / stride + 1;
+            layer.m_outH = (h + 2*padding - size) / stride + 1;
+            layer.m_outC = section.getInt("filters", 1);
+        }
+        else if(section.m_type == "maxpool")
+        {
+            int stride = section.getInt("stride", 1);
+            int size = section.getInt("size", stride);
+            int padding = section.getInt("padding", size - 1);
+            layer.m_outW = (w + padding - size) / stride + 1;
+            layer.m_outH = (h + padding - size) / stride + 1;
+            layer.m_outC = c;
+        }
+        else if(section.m_type == "avgpool")
+        {
+            layer.m_outW = 1;
+            layer.m_outH = 1;
+            layer.m_outC = c;
+        }
+        else if(section.m_type == "upsample")
+        {
+            int stride = section.getInt("stride", 2);
+            layer.m_outW = w * stride;
+            layer.m_outH = h * stride;
+            layer.m_outC = c;
+        }
+        else if(section.m_type == "route")
+        {
+            auto refs = m_config.getLayerRefs(i, "layers");
+            if(refs.empty())
+                throw CException(CoreExCode::INVALID_PARAMETER, "Invalid [route] layer.", __func__, __FILE__, __LINE__);
+
+            layer.m_outW = m_layers[refs[0]].m_outW;
+            layer.m_outH = m_layers[refs[0]].m_outH;
+            layer.m_outC = 0;
+
+            for(auto&& ref : refs)
+                layer.m_outC += m_layers[ref].m_outC;
+
+            layer.m_outC /= section.getInt("groups", 1);
+        }
+        else if(section.m_type == "shortcut")
+        {
+            if(section.get("weights_type", "none") != "none")
+                throw CException(CoreExCode::NOT_IMPLEMENTED, "Weighted [shortcut] layer is not supported.", __func__, __FILE__, __LINE__);
+
+            layer.m_outW = w;
+            layer.m_outH = h;
+            layer.m_outC = c;
+        }
+        else if(section.m_type == "scale_channels")
+        {
+            auto refs = m_config.getLayerRefs(i, "from");
+            if(refs.size() != 1)
+                throw CException(CoreExCode::INVALID_PARAMETER, "Invalid [scale_channels] layer.", __func__, __FILE__, __LINE__);
+
+            layer.m_outW = m_layers[refs[0]].m_outW;
+            layer.m_outH = m_layers[refs[0]].m_outH;
+            layer.m_outC = m_layers[refs[0]].m_outC;
+        }
+        else if(section.m_type == "dropout" || section.m_type == "yolo")
+        {
+            layer.m_outW = w;
+            layer.m_outH = h;
+            layer.m_outC = c;
+        }
+        else
+            throw CException(CoreExCode::NOT_IMPLEMENTED, "Unsupported darknet layer: [" + section.m_type + "]", __func__, __FILE__, __LINE__);
+
+        w = layer.m_outW;
+        h = layer.m_outH;
+        c = layer.m_outC;
+    }
+}
+
+double CDarknetModel::computeFlops() const
+{
+    double flops = 0.0;
+    for(size_t i=0; i<m_layers.size(); ++i)
+    {
+        const auto& section = m_config.getLayer(i);
+        if(section.m_type != "convolutional")
+            continue;
+
+        const auto& layer = m_layers[i];
+        int size = section.getInt("size", 1);
+        int groups = section.getInt("groups", 1);
+        flops += 2.0 * layer.m_outW * layer.m_outH * layer.m_outC * (layer.m_inC / groups) * size * size;
+    }
+    return flops;
+}
+
+void CDarknetModel::loadWeights(const std::string &path)
+{
+    std::ifstream file(path, std::ios::in | std::ios::binary);
+    if(!file.is_open())
+        throw CException(CoreExCode::INVALID_FILE, "Unable to read darknet weights file: " + path, __func__, __FILE__, __LINE__);
+
+    auto read = [&file, &path](std::vector<float>& values, size_t count)
+    {
+        values.resize(count);
+        file.read(reinterpret_cast<char*>(values.data()), count * sizeof(float));
+
+        if(!file.good())
+            throw CException(CoreExCode::INVALID_FILE, "Truncated darknet weights file: " + path, __func__, __FILE__, __LINE__);
+    };
+
+    file.read(reinterpret_cast<char*>(&m_major), sizeof(int32_t));
+    file.read(reinterpret_cast<char*>(&m_minor), sizeof(int32_t));
+    file.read(reinterpret_cast<char*>(&m_revision), sizeof(int32_t));
+
+    if(m_major * 10 + m_minor >= 2)
+        file.read(reinterpret_cast<char*>(&m_seen), sizeof(uint64_t));
+    else
+    {
+        uint32_t seen = 0;
+        file.read(reinterpret_cast<char*>(&seen), sizeof(uint32_t));
+        m_seen = seen;
+    }
+
+    for(size_t i=0; i<m_layers.size(); ++i)
+    {
+        const auto& section = m_config.getLayer(i);
+        if(section.m_type != "convolutional")
+            continue;
+
+        auto& layer = m_layers[i];
+        int size = section.getInt("size", 1);
+        int groups = section.getInt("groups", 1);
+        size_t filters = (size_t)layer.m_outC;
+        read(layer.m_biases, filters);
+
+        if(section.getInt("batch_normalize", 0))
+        {
+            read(layer.m_scales, filters);
+            read(layer.m_rollingMean, filters);
+            read(layer.m_rollingVariance, filters);
+        }
+        else
+        {
+            layer.m_scales.clear();
+            layer.m_rollingMean.clear();
+            layer.m_rollingVariance.clear();
+        }
+        read(layer.m_weights, filters * (layer.m_inC / groups) * size * size);
+    }
+}
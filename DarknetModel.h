@@ -0,0 +1,66 @@
+#ifndef DARKNETMODEL_H
+#define DARKNETMODEL_H
+
+#include <cstdint>
+#include "DarknetConfig.h"
+
+//-------------------------//
+//----- CDarknetModel -----//
+//-------------------------//
+// Darknet network description and weights, with output shapes of every layer.
+// Only layers used by the YOLO templates of the plugin are supported.
+class YOLOTRAIN_EXPORT CDarknetModel
+{
+    public:
+
+        struct Layer
+        {
+            int                 m_inW = 0;
+            int                 m_inH = 0;
+            int                 m_inC = 0;
+            int                 m_outW = 0;
+            int                 m_outH = 0;
+            int                 m_outC = 0;
+            // Convolution parameters, batch normalization beta is stored in biases like darknet
+            std::vector<float>  m_biases;
+            std::vector<float>  m_scales;
+            std::vector<float>  m_rollingMean;
+            std::vector<float>  m_rollingVariance;
+            std::vector<float>  m_weights;
+        };
+
+        CDarknetModel(const std::string& cfgPath, const std::string& weightsPath);
+
+        void                    save(const std::string& cfgPath, const std::string& weightsPath) const;
+
+        CDarknetConfig&         getConfig();
+        const CDarknetConfig&   getConfig() const;
+        size_t                  getLayerCount() const;
+        Layer&                  getLayer(size_t index);
+        const Layer&            getLayer(size_t index) const;
+
+        // Number of images seen during training, stored in weights header
+        uint64_t                getSeen() const;
+        void                    setSeen(uint64_t seen);
+
+        // Recompute layer shapes after config modification
+        void                    updateShapes();
+
+        // Multiply-add operations of convolutions x2, for one image
+        double                  computeFlops() const;
+
+    private:
+
+        void                    loadWeights(const std::string& path);
+
+    private:
+
+        CDarknetConfig      m_config;
+        std::vector<Layer>  m_layers;
+        int32_t             m_major = 0;
+        int32_t             m_minor = 2;
+        int32_t             m_revision = 0;
+        uint64_t            m_seen = 0;
+};
+
+#endif // DARKNETMODEL_H
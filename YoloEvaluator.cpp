@@ -0,0 +1,470 @@
+#include <fstream>
+#include <mutex>
+#include <numeric>
+#include <cmath>
+#include <boost/filesystem.hpp>
+#include <opencv2/core/utility.hpp>
+#include <opencv2/imgcodecs.hpp>
+#include "YoloEvaluator.h"
+#include "DarknetConfig.h"
+#include "Main/CoreTools.hpp"
+
+//--------------------------//
+//----- CYoloEvaluator -----//
+//--------------------------//
+CYoloEvaluator::CYoloEvaluator(const std::string &evalListPath, int classCount)
+{
+    m_classCount = classCount;
+    loadGroundTruth(evalListPath);
+}
+
+size_t CYoloEvaluator::getImageCount() const
+{
+    return m_imagePaths.size();
+}
+
+void CYoloEvaluator::setWorkerCount(int count)
+{
+    m_workerCount = count;
+}
+
+void CYoloEvaluator::setConfidenceThreshold(float threshold)
+{
+    m_confThreshold = threshold;
+}
+
+void CYoloEvaluator::setNmsThreshold(float threshold)
+{
+    m_nmsThreshold = threshold;
+}
+
+CYoloEvalResult CYoloEvaluator::evaluate(const std::string &cfgPath, const std::string &weightsPath, const std::atomic_bool &bStop) const
+{
+    // Retrieve [yolo] heads from config: raw outputs are taken from the preceding convolution
+    CDarknetConfig config(cfgPath);
+    cv::Size inputSize(config.getNet().getInt("width", 416), config.getNet().getInt("height", 416));
+    std::vector<YoloHead> heads;
+
+    for(size_t i=0; i<config.getLayerCount(); ++i)
+    {
+        auto& layer = config.getLayer(i);
+        if(layer.m_type != "yolo")
+            continue;
+
+        if(i == 0 || config.getLayer(i - 1).m_type != "convolutional")
+            throw CException(CoreExCode::NOT_IMPLEMENTED, "Unsupported [yolo] layer input.", __func__, __FILE__, __LINE__);
+
+        if(layer.getInt("classes", 0) != m_classCount)
+            throw CException(CoreExCode::INVALID_PARAMETER, "Classes count mismatch between config and dataset.", __func__, __FILE__, __LINE__);
+
+        auto anchors = layer.getFloats("anchors");
+        auto mask = layer.getInts("mask");
+        if(mask.empty())
+        {
+            for(int j=0; j<layer.getInt("num", 1); ++j)
+                mask.push_back(j);
+        }
+
+        // OpenCV imports a non-linear convolution activation as a separate layer:
+        // raw convolution output is read and the activation is applied at decoding
+        auto activation = config.getLayer(i - 1).get("activation", "logistic");
+        if(activation != "linear" && activation != "logistic")
+            throw CException(CoreExCode::NOT_IMPLEMENTED, "Unsupported activation before [yolo] layer: " + activation, __func__, __FILE__, __LINE__);
+
+        YoloHead head;
+        head.m_outputName = "conv_" + std::to_string(i - 1);
+        head.m_bLogistic = activation == "logistic";
+        head.m_scaleXY = layer.getFloat("scale_x_y", 1.0f);
+        head.m_bNewCoords = layer.getInt("new_coords", 0) != 0;
+
+        for(auto&& m : mask)
+        {
+            if(2*m + 1 >= (int)anchors.size())
+                throw CException(CoreExCode::INVALID_PARAMETER, "Invalid anchors in [yolo] layer.", __func__, __FILE__, __LINE__);
+
+            head.m_anchors.push_back(anchors[2*m] / inputSize.width);
+            head.m_anchors.push_back(anchors[2*m + 1] / inputSize.height);
+        }
+        heads.push_back(head);
+    }
+
+    if(heads.empty())
+        throw CException(CoreExCode::INVALID_PARAMETER, "No [yolo] layer found in config file.", __func__, __FILE__, __LINE__);
+
+    const size_t imageCount = m_imagePaths.size();
+    int workerCount = m_workerCount > 0 ? m_workerCount : cv::getNumberOfCPUs();
+    workerCount = std::max(1, std::min(workerCount, (int)imageCount));
+
+    std::vector<std::vector<Box>> detections(imageCount);
+    std::vector<double> latencies(workerCount, 0.0);
+    std::vector<size_t> counts(workerCount, 0);
+    std::atomic<size_t> nextImage{0};
+    std::exception_ptr exceptionPtr = nullptr;
+    std::mutex exceptionMutex;
+
+    // Images are pulled dynamically by workers to balance the load
+    cv::parallel_for_(cv::Range(0, workerCount), [&](const cv::Range& range)
+    {
+        for(int w=range.start; w<range.end; ++w)
+        {
+            try
+            {
+                auto net = cv::dnn::readNetFromDarknet(cfgPath, weightsPath);
+                net.setPreferableBackend(cv::dnn::DNN_BACKEND_OPENCV);
+                net.setPreferableTarget(cv::dnn::DNN_TARGET_CPU);
+
+                size_t index;
+                while(bStop == false && (index = nextImage++) < imageCount)
+                {
+                    double latency = 0.0;
+                    detections[index] = detect(net, heads, inputSize, m_imagePaths[index], latency);
+                    latencies[w] += latency;
+                    counts[w]++;
+                }
+            }
+            catch(...)
+            {
+                std::lock_guard<std::mutex> lock(exceptionMutex);
+                if(exceptionPtr == nullptr)
+                    exceptionPtr = std::current_exception();
+            }
+        }
+    }, workerCount);
+
+    if(exceptionPtr)
+        std::rethrow_exception(exceptionPtr);
+
+    CYoloEvalResult result;
+    result.m_imageCount = std::accumulate(counts.begin(), counts.end(), (size_t)0);
+    if(result.m_imageCount > 0)
+        result.m_latency = std::accumulate(latencies.begin(), latencies.end(), 0.0) / result.m_imageCount;
+
+    if(bStop == false)
+        computeAP(detections, result);
+
+    return result;
+}
+
+double CYoloEvaluator::measureLatency(const std::string &cfgPath, const std::string &weightsPath, size_t imageCount) const
+{
+    CDarknetConfig config(cfgPath);
+    cv::Size inputSize(config.getNet().getInt("width", 416), config.getNet().getInt("height", 416));
+    auto net = cv::dnn::readNetFromDarknet(cfgPath, weightsPath);
+    net.setPreferableBackend(cv::dnn::DNN_BACKEND_OPENCV);
+    net.setPreferableTarget(cv::dnn::DNN_TARGET_CPU);
+
+    double latency = 0.0;
+    size_t count = 0;
+    cv::TickMeter timer;
+
+    for(size_t i=0; i<m_imagePaths.size() && count<imageCount; ++i)
+    {
+        cv::Mat image = cv::imread(m_imagePaths[i], cv::IMREAD_COLOR);
+        if(image.empty())
+            continue;
+
+        net.setInput(cv::dnn::blobFromImage(image, 1.0/255.0, inputSize, cv::Scalar(), true, false));
+        if(count == 0)
+            net.forward();
+
+        timer.reset();
+        timer.start();
+        net.forward();
+        timer.stop();
+        latency += timer.getTimeMilli();
+        count++;
+    }
+
+    if(count == 0)
+        throw CException(CoreExCode::INVALID_FILE, "No readable image to measure latency.", __func__, __FILE__, __LINE__);
+
+    return latency / count;
+}
+
+void CYoloEvaluator::loadGroundTruth(const std::string &evalListPath)
+{
+    std::ifstream evalFile(evalListPath);
+    if(!evalFile.is_open())
+        throw CException(CoreExCode::INVALID_FILE, "Unable to read evaluation image list: " + evalListPath, __func__, __FILE__, __LINE__);
+
+    std::string imagePath;
+    while(std::getline(evalFile, imagePath))
+    {
+        if(imagePath.empty())
+            continue;
+
+        // Label file follows the same naming rule as in CYoloTrain::createAnnotationFiles()
+        boost::filesystem::path imgPath(imagePath);
+        std::string txtFilePath = imgPath.parent_path().string() + "/" + imgPath.stem().string() + ".txt";
+        std::ifstream labelFile(txtFilePath);
+        std::vector<Box> boxes;
+        Box box;
+        double cx, cy, w, h;
+
+        while(labelFile >> box.m_classId >> cx >> cy >> w >> h)
+        {
+            if(box.m_classId < 0 || box.m_classId >= m_classCount)
+                continue;
+
+            box.m_rect = cv::Rect2d(cx - w/2.0, cy - h/2.0, w, h);
+            boxes.push_back(box);
+        }
+        m_imagePaths.push_back(imagePath);
+        m_groundTruth.push_back(boxes);
+    }
+}
+
+std::vector<CYoloEvaluator::Box> CYoloEvaluator::detect(cv::dnn::Net &net, const std::vector<YoloHead> &heads, const cv::Size &inputSize, const std::string &imagePath, double &latency) const
+{
+    std::vector<Box> boxes;
+    cv::Mat image = cv::imread(imagePath, cv::IMREAD_COLOR);
+
+    if(image.empty())
+        return boxes;
+
+    // Darknet training resizes without letterbox, boxes are thus normalized with respect to the whole image
+    cv::Mat blob = cv::dnn::blobFromImage(image, 1.0/255.0, inputSize, cv::Scalar(), true, false);
+    std::vector<std::string> outputNames;
+    std::vector<cv::Mat> outputs;
+
+    for(auto&& head : heads)
+        outputNames.push_back(head.m_outputName);
+
+    cv::TickMeter timer;
+    timer.start();
+    net.setInput(blob);
+    net.forward(outputs, outputNames);
+    timer.stop();
+    latency = timer.getTimeMilli();
+
+    auto sigmoid = [](float x){ return 1.0f / (1.0f + std::exp(-x)); };
+    std::vector<std::vector<cv::Rect2d>> classRects(m_classCount);
+    std::vector<std::vector<float>> classScores(m_classCount);
+    const int channels = 5 + m_classCount;
+
+    for(size_t i=0; i<heads.size(); ++i)
+    {
+        const auto& head = heads[i];
+        const cv::Mat& output = outputs[i];
+        const int anchorCount = (int)head.m_anchors.size() / 2;
+
+        if(output.dims != 4 || output.size[1] != anchorCount * channels)
+            throw CException(CoreExCode::INVALID_SIZE, "Unexpected [yolo] head output shape.", __func__, __FILE__, __LINE__);
+
+        const int gridH = output.size[2];
+        const int gridW = output.size[3];
+        const size_t planeSize = (size_t)gridH * gridW;
+        const float offsetXY = 0.5f * (head.m_scaleXY - 1.0f);
+
+        for(int a=0; a<anchorCount; ++a)
+        {
+            const float* pAnchor = output.ptr<float>() + a * channels * planeSize;
+            for(int y=0; y<gridH; ++y)
+            {
+                for(int x=0; x<gridW; ++x)
+                {
+                    const size_t cell = y * gridW + x;
+                    auto value = [&](int c)
+                    {
+                        float v = pAnchor[c * planeSize + cell];
+                        return head.m_bLogistic ? sigmoid(v) : v;
+                    };
+                    float objectness = head.m_bNewCoords ? value(4) : sigmoid(value(4));
+
+                    if(objectness <= m_confThreshold)
+                        continue;
+
+                    float bx, by, bw, bh;
+                    if(head.m_bNewCoords)
+                    {
+                        bx = (x + value(0) * head.m_scaleXY - offsetXY) / gridW;
+                        by = (y + value(1) * head.m_scaleXY - offsetXY) / gridH;
+                        bw = value(2) * value(2) * 4.0f * head.m_anchors[2*a];
+                        bh = value(3) * value(3) * 4.0f * head.m_anchors[2*a + 1];
+                    }
+                    else
+                    {
+                        bx = (x + sigmoid(value(0)) * head.m_scaleXY - offsetXY) / gridW;
+                        by = (y + sigmoid(value(1)) * head.m_scaleXY - offsetXY) / gridH;
+                        bw = std::exp(value(2)) * head.m_anchors[2*a];
+                        bh = std::exp(value(3)) * head.m_anchors[2*a + 1];
+                    }
+
+                    for(int c=0; c<m_classCount; ++c)
+                    {
+                        float prob = objectness * (head.m_bNewCoords ? value(5 + c) : sigmoid(value(5 + c)));
+                        if(prob > m_confThreshold)
+                        {
+                            classRects[c].push_back(cv::Rect2d(bx - bw/2.0, by - bh/2.0, bw, bh));
+                            classScores[c].push_back(prob);
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    // Per class NMS, as darknet does for mAP computation
+    for(int c=0; c<m_classCount; ++c)
+    {
+        std::vector<int> indices;
+        cv::dnn::NMSBoxes(classRects[c], classScores[c], m_confThreshold, m_nmsThreshold, indices);
+
+        for(auto&& index : indices)
+        {
+            Box box;
+            box.m_classId = c;
+            box.m_score = classScores[c][index];
+            box.m_rect = classRects[c][index];
+            boxes.push_back(box);
+        }
+    }
+    return boxes;
+}
+
+void CYoloEvaluator::computeAP(const std::vector<std::vector<Box>> &detections, CYoloEvalResult &result) const
+{
+    const int thresholdCount = 10;
+    result.m_classAP50.assign(m_classCount, -1.0f);
+    result.m_classAP.assign(m_classCount, -1.0f);
+
+    cv::parallel_for_(cv::Range(0, m_classCount), [&](const cv::Range& range)
+    {
+        for(int c=range.start; c<range.end; ++c)
+        {
+            // Ground truth of class c, indexed by image
+            std::vector<std::vector<cv::Rect2d>> gtRects(m_groundTruth.size());
+            size_t gtCount = 0;
+
+            for(size_t i=0; i<m_groundTruth.size(); ++i)
+            {
+                for(auto&& gt : m_groundTruth[i])
+                {
+                    if(gt.m_classId == c)
+                    {
+                        gtRects[i].push_back(gt.m_rect);
+                        gtCount++;
+                    }
+                }
+            }
+
+            // Classes without ground truth are left to -1 and excluded from mean values
+            if(gtCount == 0)
+                continue;
+
+            // Detections of class c sorted by decreasing score,
+            // with the best overlapping ground truth which does not depend on IoU threshold
+            struct Match
+            {
+                float   m_score;
+                size_t  m_image;
+                int     m_gtIndex;
+                double  m_iou;
+            };
+            std::vector<Match> matches;
+
+            for(size_t i=0; i<detections.size(); ++i)
+            {
+                for(auto&& det : detections[i])
+                {
+                    if(det.m_classId != c)
+                        continue;
+
+                    Match match = {det.m_score, i, -1, 0.0};
+                    for(size_t j=0; j<gtRects[i].size(); ++j)
+                    {
+                        double iou = computeIoU(det.m_rect, gtRects[i][j]);
+                        if(iou > match.m_iou)
+                        {
+                            match.m_iou = iou;
+                            match.m_gtIndex = (int)j;
+                        }
+                    }
+                    matches.push_back(match);
+                }
+            }
+
+            std::sort(matches.begin(), matches.end(), [](const Match& m1, const Match& m2){ return m1.m_score > m2.m_score; });
+
+            float apSum = 0.0f;
+            for(int t=0; t<thresholdCount; ++t)
+            {
+                const double iouThreshold = 0.5 + 0.05 * t;
+                std::vector<std::vector<bool>> bMatched(gtRects.size());
+                std::vector<float> recalls, precisions;
+                size_t tp = 0, fp = 0;
+
+                for(size_t i=0; i<gtRects.size(); ++i)
+                    bMatched[i].assign(gtRects[i].size(), false);
+
+                for(auto&& match : matches)
+                {
+                    if(match.m_gtIndex >= 0 && match.m_iou >= iouThreshold && bMatched[match.m_image][match.m_gtIndex] == false)
+                    {
+                        bMatched[match.m_image][match.m_gtIndex] = true;
+                        tp++;
+                    }
+                    else
+                        fp++;
+
+                    recalls.push_back((float)tp / gtCount);
+                    precisions.push_back((float)tp / (tp + fp));
+                }
+
+                float ap = computeAveragePrecision(recalls, precisions);
+                if(t == 0)
+                    result.m_classAP50[c] = ap;
+
+                apSum += ap;
+            }
+            result.m_classAP[c] = apSum / thresholdCount;
+        }
+    });
+
+    int validCount = 0;
+    result.m_mAP50 = 0.0f;
+    result.m_mAP = 0.0f;
+
+    for(int c=0; c<m_classCount; ++c)
+    {
+        if(result.m_classAP50[c] < 0)
+            continue;
+
+        result.m_mAP50 += result.m_classAP50[c];
+        result.m_mAP += result.m_classAP[c];
+        validCount++;
+    }
+
+    if(validCount > 0)
+    {
+        result.m_mAP50 /= validCount;
+        result.m_mAP /= validCount;
+    }
+}
+
+float CYoloEvaluator::computeAveragePrecision(std::vector<float> &recalls, std::vector<float> &precisions)
+{
+    // All points interpolation (VOC2010+), same as darknet default
+    recalls.insert(recalls.begin(), 0.0f);
+    recalls.push_back(1.0f);
+    precisions.insert(precisions.begin(), 0.0f);
+    precisions.push_back(0.0f);
+
+    for(int i=(int)precisions.size()-2; i>=0; --i)
+        precisions[i] = std::max(precisions[i], precisions[i+1]);
+
+    float ap = 0.0f;
+    for(size_t i=1; i<recalls.size(); ++i)
+    {
+        if(recalls[i] != recalls[i-1])
+            ap += (recalls[i] - recalls[i-1]) * precisions[i];
+    }
+    return ap;
+}
+
+double CYoloEvaluator::computeIoU(const cv::Rect2d &box1, const cv::Rect2d &box2)
+{
+    double inter = (box1 & box2).area();
+    double uni = box1.area() + box2.area() - inter;
+    return uni > 0 ? inter / uni : 0.0;
+}
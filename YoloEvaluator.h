@@ -0,0 +1,89 @@
+#ifndef YOLOEVALUATOR_H
+#define YOLOEVALUATOR_H
+
+#include <atomic>
+#include <opencv2/core.hpp>
+#include <opencv2/dnn.hpp>
+#include "YoloTrainGlobal.hpp"
+
+//---------------------------//
+//----- CYoloEvalResult -----//
+//---------------------------//
+struct YOLOTRAIN_EXPORT CYoloEvalResult
+{
+    size_t              m_imageCount = 0;
+    // Average precision per class at IoU=0.5
+    std::vector<float>  m_classAP50;
+    // Average precision per class averaged over IoU=0.5:0.05:0.95
+    std::vector<float>  m_classAP;
+    float               m_mAP50 = 0.0f;
+    float               m_mAP = 0.0f;
+    // Mean forward time per image (ms)
+    double              m_latency = 0.0;
+};
+
+//--------------------------//
+//----- CYoloEvaluator -----//
+//--------------------------//
+// Compute detection metrics of darknet checkpoints with OpenCV DNN on CPU.
+// Ground truth is read once from the darknet label files of the images listed in the eval file.
+// Images are dispatched to parallel workers, each worker owns its network instance.
+// Raw outputs of [yolo] heads are decoded here rather than by OpenCV region layer,
+// because the latter drops scores lower than 0.2 and thus truncates precision-recall curves.
+class YOLOTRAIN_EXPORT CYoloEvaluator
+{
+    public:
+
+        CYoloEvaluator(const std::string& evalListPath, int classCount);
+
+        size_t              getImageCount() const;
+
+        void                setWorkerCount(int count);
+        void                setConfidenceThreshold(float threshold);
+        void                setNmsThreshold(float threshold);
+
+        CYoloEvalResult     evaluate(const std::string& cfgPath, const std::string& weightsPath, const std::atomic_bool& bStop) const;
+
+        // Mean forward time per image (ms) of a single network on the first eval images, after one warm-up pass.
+        // Must not run concurrently with other evaluations to get meaningful values.
+        double              measureLatency(const std::string& cfgPath, const std::string& weightsPath, size_t imageCount) const;
+
+    private:
+
+        struct Box
+        {
+            int         m_classId = 0;
+            float       m_score = 0.0f;
+            cv::Rect2d  m_rect;
+        };
+
+        struct YoloHead
+        {
+            std::string         m_outputName;
+            std::vector<float>  m_anchors;
+            float               m_scaleXY = 1.0f;
+            bool                m_bNewCoords = false;
+            // Logistic activation of the convolution feeding the head (new_coords models)
+            bool                m_bLogistic = false;
+        };
+
+        void                loadGroundTruth(const std::string& evalListPath);
+
+        std::vector<Box>    detect(cv::dnn::Net& net, const std::vector<YoloHead>& heads, const cv::Size& inputSize, const std::string& imagePath, double& latency) const;
+
+        void                computeAP(const std::vector<std::vector<Box>>& detections, CYoloEvalResult& result) const;
+
+        static float        computeAveragePrecision(std::vector<float>& recalls, std::vector<float>& precisions);
+        static double       computeIoU(const cv::Rect2d& box1, const cv::Rect2d& box2);
+
+    private:
+
+        int                             m_classCount = 0;
+        int                             m_workerCount = 2;
+        float                           m_confThreshold = 0.005f;
+        float                           m_nmsThreshold = 0.45f;
+        std::vector<std::string>        m_imagePaths;
+        std::vector<std::vector<Box>>   m_groundTruth;
+};
+
+#endif // YOLOEVALUATOR_H
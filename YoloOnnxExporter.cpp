@@ -0,0 +1,580 @@
+#include <fstream>
+#include <cmath>
+#include <opencv2/imgcodecs.hpp>
+#include <opencv2/dnn.hpp>
+#include "YoloOnnxExporter.h"
+#include "Main/CoreTools.hpp"
+
+namespace
+{
+    // Minimal protocol buffers encoder, enough to serialize ONNX ModelProto.
+    // Floats are written in host byte order: little-endian platforms only, as ONNX raw data.
+    class CProtoWriter
+    {
+        public:
+
+            void    writeInt(int field, int64_t value)
+            {
+                writeTag(field, 0);
+                writeVarint((uint64_t)value);
+            }
+            void    writeFloat(int field, float value)
+            {
+                writeTag(field, 5);
+                m_buffer.append(reinterpret_cast<const char*>(&value), sizeof(float));
+            }
+            void    writeBytes(int field, const std::string& value)
+            {
+                writeMessageHeader(field, value.size());
+                m_buffer += value;
+            }
+            void    writeMessage(int field, const CProtoWriter& message)
+            {
+                writeBytes(field, message.m_buffer);
+            }
+            // Field header of a message whose content is written separately
+            void    writeMessageHeader(int field, size_t length)
+            {
+                writeTag(field, 2);
+                writeVarint(length);
+            }
+
+            const std::string&  getData() const
+            {
+                return m_buffer;
+            }
+
+        private:
+
+            void    writeTag(int field, int wireType)
+            {
+                writeVarint(((uint64_t)field << 3) | wireType);
+            }
+            void    writeVarint(uint64_t value)
+            {
+                while(value >= 0x80)
+                {
+                    m_buffer.push_back((char)(value | 0x80));
+                    value >>= 7;
+                }
+                m_buffer.push_back((char)value);
+            }
+
+        private:
+
+            std::string m_buffer;
+    };
+
+    // ONNX enums and field numbers (onnx.proto)
+    enum OnnxDataType { ONNX_FLOAT = 1, ONNX_INT64 = 7 };
+    enum OnnxAttributeType { ONNX_ATTR_FLOAT = 1, ONNX_ATTR_INT = 2, ONNX_ATTR_STRING = 3, ONNX_ATTR_INTS = 7 };
+
+    CProtoWriter makeAttribute(const std::string& name, int64_t value)
+    {
+        CProtoWriter attr;
+        attr.writeBytes(1, name);
+        attr.writeInt(3, value);
+        attr.writeInt(20, ONNX_ATTR_INT);
+        return attr;
+    }
+
+    CProtoWriter makeAttribute(const std::string& name, float value)
+    {
+        CProtoWriter attr;
+        attr.writeBytes(1, name);
+        attr.writeFloat(2, value);
+        attr.writeInt(20, ONNX_ATTR_FLOAT);
+        return attr;
+    }
+
+    CProtoWriter makeAttribute(const std::string& name, const std::string& value)
+    {
+        CProtoWriter attr;
+        attr.writeBytes(1, name);
+        attr.writeBytes(4, value);
+        attr.writeInt(20, ONNX_ATTR_STRING);
+        return attr;
+    }
+
+    CProtoWriter makeAttribute(const std::string& name, const std::vector<int64_t>& values)
+    {
+        CProtoWriter attr;
+        attr.writeBytes(1, name);
+        for(auto&& value : values)
+            attr.writeInt(8, value);
+
+        attr.writeInt(20, ONNX_ATTR_INTS);
+        return attr;
+    }
+
+    //----------------------//
+    //----- COnnxGraph -----//
+    //----------------------//
+    class COnnxGraph
+    {
+        public:
+
+            COnnxGraph(const std::string& name)
+            {
+                m_graph.writeBytes(2, name);
+            }
+
+            void        addInput(const std::string& name, const std::vector<int64_t>& dims)
+            {
+                m_graph.writeMessage(11, makeValueInfo(name, dims));
+            }
+            void        addOutput(const std::string& name, const std::vector<int64_t>& dims)
+            {
+                m_graph.writeMessage(12, makeValueInfo(name, dims));
+            }
+
+            std::string addConstant(const std::string& name, const std::vector<int64_t>& dims, const std::vector<float>& values)
+            {
+                std::string data(reinterpret_cast<const char*>(values.data()), values.size() * sizeof(float));
+                return addInitializer(name, dims, ONNX_FLOAT, data);
+            }
+            std::string addConstant(const std::string& name, const std::vector<int64_t>& values)
+            {
+                std::string data(reinterpret_cast<const char*>(values.data()), values.size() * sizeof(int64_t));
+                return addInitializer(name, {(int64_t)values.size()}, ONNX_INT64, data);
+            }
+
+            std::string addNode(const std::string& opType, const std::vector<std::string>& inputs, const std::string& output,
+                                const std::vector<CProtoWriter>& attributes = {})
+            {
+                CProtoWriter node;
+                for(auto&& input : inputs)
+                    node.writeBytes(1, input);
+
+                node.writeBytes(2, output);
+                node.writeBytes(3, output);
+                node.writeBytes(4, opType);
+
+                for(auto&& attr : attributes)
+                    node.writeMessage(5, attr);
+
+                m_graph.writeMessage(1, node);
+                return output;
+            }
+
+            const CProtoWriter& getProto() const
+            {
+                return m_graph;
+            }
+
+        private:
+
+            std::string     addInitializer(const std::string& name, const std::vector<int64_t>& dims, int dataType, const std::string& data)
+            {
+                CProtoWriter tensor;
+                for(auto&& dim : dims)
+                    tensor.writeInt(1, dim);
+
+                tensor.writeInt(2, dataType);
+                tensor.writeBytes(8, name);
+                tensor.writeBytes(9, data);
+                m_graph.writeMessage(5, tensor);
+                return name;
+            }
+
+            CProtoWriter    makeValueInfo(const std::string& name, const std::vector<int64_t>& dims) const
+            {
+                CProtoWriter shape;
+                for(auto&& dim : dims)
+                {
+                    CProtoWriter dimension;
+                    dimension.writeInt(1, dim);
+                    shape.writeMessage(1, dimension);
+                }
+
+                CProtoWriter tensorType;
+                tensorType.writeInt(1, ONNX_FLOAT);
+                tensorType.writeMessage(2, shape);
+
+                CProtoWriter type;
+                type.writeMessage(1, tensorType);
+
+                CProtoWriter valueInfo;
+                valueInfo.writeBytes(1, name);
+                valueInfo.writeMessage(2, type);
+                return valueInfo;
+            }
+
+        private:
+
+            CProtoWriter    m_graph;
+    };
+
+    std::string addActivation(COnnxGraph& graph, const std::string& input, const std::string& activation)
+    {
+        if(activation == "linear")
+            return input;
+        else if(activation == "leaky")
+            return graph.addNode("LeakyRelu", {input}, input + "_leaky", {makeAttribute("alpha", 0.1f)});
+        else if(activation == "relu")
+            return graph.addNode("Relu", {input}, input + "_relu");
+        else if(activation == "logistic")
+            return graph.addNode("Sigmoid", {input}, input + "_logistic");
+        else if(activation == "swish")
+        {
+            auto sigmoid = graph.addNode("Sigmoid", {input}, input + "_sigmoid");
+            return graph.addNode("Mul", {input, sigmoid}, input + "_swish");
+        }
+        else if(activation == "mish")
+        {
+            auto softplus = graph.addNode("Softplus", {input}, input + "_softplus");
+            auto tanh = graph.addNode("Tanh", {softplus}, input + "_tanh");
+            return graph.addNode("Mul", {input, tanh}, input + "_mish");
+        }
+        else
+            throw CException(CoreExCode::NOT_IMPLEMENTED, "Unsupported darknet activation for ONNX export: " + activation, __func__, __FILE__, __LINE__);
+    }
+}
+
+//-----------------------------//
+//----- CYoloOnnxExporter -----//
+//-----------------------------//
+CYoloOnnxExporter::CYoloOnnxExporter(const std::string &cfgPath, const std::string &weightsPath) :
+    m_cfgPath(cfgPath),
+    m_weightsPath(weightsPath),
+    m_model(cfgPath, weightsPath)
+{
+}
+
+void CYoloOnnxExporter::exportModel(const std::string &onnxPath) const
+{
+    const auto& config = m_model.getConfig();
+    const auto& net = config.getNet();
+    const int netW = net.getInt("width", 416);
+    const int netH = net.getInt("height", 416);
+    const int netC = net.getInt("channels", 3);
+
+    COnnxGraph graph("darknet_yolo");
+    graph.addInput("images", {1, netC, netH, netW});
+
+    // Tensor name of each layer output, layers without computation are aliases
+    std::vector<std::string> outputs(m_model.getLayerCount());
+
+    for(size_t i=0; i<m_model.getLayerCount(); ++i)
+    {
+        const auto& section = config.getLayer(i);
+        const auto& layer = m_model.getLayer(i);
+        const std::string input = i == 0 ? "images" : outputs[i-1];
+        const std::string name = section.m_type + "_" + std::to_string(i);
+
+        if(section.m_type == "convolutional")
+        {
+            const int size = section.getInt("size", 1);
+            const int stride = section.getInt("stride", 1);
+            const int padding = section.getInt("pad", 0) ? size / 2 : section.getInt("padding", 0);
+            const int groups = section.getInt("groups", 1);
+            const size_t kernelSize = (size_t)(layer.m_inC / groups) * size * size;
+
+            // Fold batch normalization like darknet inference: (x - mean) / (sqrt(var) + .000001)
+            std::vector<float> weights = layer.m_weights;
+            std::vector<float> biases = layer.m_biases;
+
+            if(!layer.m_scales.empty())
+            {
+                for(int o=0; o<layer.m_outC; ++o)
+                {
+                    float scale = layer.m_scales[o] / (std::sqrt(layer.m_rollingVariance[o]) + .000001f);
+                    for(size_t k=0; k<kernelSize; ++k)
+                        weights[o * kernelSize + k] *= scale;
+
+                    biases[o] -= layer.m_rollingMean[o] * scale;
+                }
+            }
+
+            auto weightsName = graph.addConstant(name + "_weights", {layer.m_outC, layer.m_inC / groups, size, size}, weights);
+            auto biasesName = graph.addConstant(name + "_biases", {layer.m_outC}, biases);
+            auto conv = graph.addNode("Conv", {input, weightsName, biasesName}, name,
+            {
+                makeAttribute("kernel_shape", std::vector<int64_t>{size, size}),
+                makeAttribute("strides", std::vector<int64_t>{stride, stride}),
+                makeAttribute("pads", std::vector<int64_t>{padding, padding, padding, padding}),
+                makeAttribute("group", (int64_t)groups)
+            });
+            outputs[i] = addActivation(graph, conv, section.get("activation", "logistic"));
+        }
+        else if(section.m_type == "maxpool")
+        {
+            // Darknet pads (padding / 2) before and the remaining after
+            const int stride = section.getInt("stride", 1);
+            const int size = section.getInt("size", stride);
+            const int padding = section.getInt("padding", size - 1);
+            const int padBegin = padding / 2;
+            const int padEnd = padding - padBegin;
+            outputs[i] = graph.addNode("MaxPool", {input}, name,
+            {
+                makeAttribute("kernel_shape", std::vector<int64_t>{size, size}),
+                makeAttribute("strides", std::vector<int64_t>{stride, stride}),
+                makeAttribute("pads", std::vector<int64_t>{padBegin, padBegin, padEnd, padEnd})
+            });
+        }
+        else if(section.m_type == "avgpool")
+            outputs[i] = graph.addNode("GlobalAveragePool", {input}, name);
+        else if(section.m_type == "upsample")
+        {
+            const float stride = (float)section.getInt("stride", 2);
+            auto roi = graph.addConstant(name + "_roi", {0}, std::vector<float>());
+            auto scales = graph.addConstant(name + "_scales", {4}, {1.0f, 1.0f, stride, stride});
+            outputs[i] = graph.addNode("Resize", {input, roi, scales}, name,
+            {
+                makeAttribute("mode", std::string("nearest")),
+                makeAttribute("coordinate_transformation_mode", std::string("asymmetric")),
+                makeAttribute("nearest_mode", std::string("floor"))
+            });
+        }
+        else if(section.m_type == "route")
+        {
+            auto refs = config.getLayerRefs(i, "layers");
+            const int groups = section.getInt("groups", 1);
+            const int groupId = section.getInt("group_id", 0);
+            std::vector<std::string> inputs;
+
+            for(auto&& ref : refs)
+            {
+                if(groups == 1)
+                    inputs.push_back(outputs[ref]);
+                else
+                {
+                    // Channel group of each input
+                    const int64_t groupSize = m_model.getLayer(ref).m_outC / groups;
+                    const auto sliceName = name + "_" + std::to_string(ref);
+                    auto starts = graph.addConstant(sliceName + "_starts", {groupId * groupSize});
+                    auto ends = graph.addConstant(sliceName + "_ends", {(groupId + 1) * groupSize});
+                    auto axes = graph.addConstant(sliceName + "_axes", {1});
+                    inputs.push_back(graph.addNode("Slice", {outputs[ref], starts, ends, axes}, sliceName));
+                }
+            }
+
+            if(inputs.size() == 1)
+                outputs[i] = inputs[0];
+            else
+                outputs[i] = graph.addNode("Concat", inputs, name, {makeAttribute("axis", (int64_t)1)});
+        }
+        else if(section.m_type == "shortcut")
+        {
+            auto refs = config.getLayerRefs(i, "from");
+            if(refs.size() != 1)
+                throw CException(CoreExCode::NOT_IMPLEMENTED, "Multi-input [shortcut] layer is not supported.", __func__, __FILE__, __LINE__);
+
+            const auto& from = m_model.getLayer(refs[0]);
+            if(from.m_outW != layer.m_outW || from.m_outH != layer.m_outH)
+                throw CException(CoreExCode::NOT_IMPLEMENTED, "[shortcut] layer with different input sizes is not supported.", __func__, __FILE__, __LINE__);
+
+            // Darknet adds the common channels only: extra channels are dropped, missing ones are zeros
+            auto addend = outputs[refs[0]];
+            if(from.m_outC > layer.m_outC)
+            {
+                auto starts = graph.addConstant(name + "_starts", {0});
+                auto ends = graph.addConstant(name + "_ends", {layer.m_outC});
+                auto axes = graph.addConstant(name + "_axes", {1});
+                addend = graph.addNode("Slice", {addend, starts, ends, axes}, name + "_slice");
+            }
+            else if(from.m_outC < layer.m_outC)
+            {
+                auto pads = graph.addConstant(name + "_pads", {0, 0, 0, 0, 0, layer.m_outC - from.m_outC, 0, 0});
+                addend = graph.addNode("Pad", {addend, pads}, name + "_pad");
+            }
+
+            auto sum = graph.addNode("Add", {input, addend}, name);
+            outputs[i] = addActivation(graph, sum, section.get("activation", "linear"));
+        }
+        else if(section.m_type == "scale_channels")
+        {
+            if(section.getInt("scale_wh", 0))
+                throw CException(CoreExCode::NOT_IMPLEMENTED, "[scale_channels] layer with scale_wh is not supported.", __func__, __FILE__, __LINE__);
+
+            auto ref = config.getLayerRefs(i, "from")[0];
+            outputs[i] = graph.addNode("Mul", {outputs[ref], input}, name);
+        }
+        else if(section.m_type == "dropout")
+            outputs[i] = input;
+        else if(section.m_type == "yolo")
+        {
+            const int gridW = layer.m_inW;
+            const int gridH = layer.m_inH;
+            const int classCount = section.getInt("classes", 0);
+            const int64_t channels = 5 + classCount;
+            const float scaleXY = section.getFloat("scale_x_y", 1.0f);
+            const bool bNewCoords = section.getInt("new_coords", 0) != 0;
+            auto anchors = section.getFloats("anchors");
+            auto mask = section.getInts("mask");
+
+            if(mask.empty())
+            {
+                for(int j=0; j<section.getInt("num", 1); ++j)
+                    mask.push_back(j);
+            }
+
+            const int anchorCount = (int)mask.size();
+            const int64_t rows = (int64_t)gridW * gridH * anchorCount;
+
+            if(layer.m_inC != anchorCount * channels)
+                throw CException(CoreExCode::INVALID_SIZE, "Invalid [yolo] layer input channels.", __func__, __FILE__, __LINE__);
+
+            // Decoding constants of each row (y, x, anchor)
+            const float offsetXY = 0.5f * (scaleXY - 1.0f);
+            std::vector<float> grid, anchorSizes;
+
+            for(int y=0; y<gridH; ++y)
+            {
+                for(int x=0; x<gridW; ++x)
+                {
+                    for(auto&& m : mask)
+                    {
+                        if(2*m + 1 >= (int)anchors.size())
+                            throw CException(CoreExCode::INVALID_PARAMETER, "Invalid anchors in [yolo] layer.", __func__, __FILE__, __LINE__);
+
+                        grid.push_back((x - offsetXY) / gridW);
+                        grid.push_back((y - offsetXY) / gridH);
+                        anchorSizes.push_back(anchors[2*m] / netW * (bNewCoords ? 4.0f : 1.0f));
+                        anchorSizes.push_back(anchors[2*m + 1] / netH * (bNewCoords ? 4.0f : 1.0f));
+                    }
+                }
+            }
+
+            // [1, A*K, H, W] -> [1, H*W*A, K]
+            auto shape1 = graph.addConstant(name + "_shape1", {1, anchorCount, channels, gridH, gridW});
+            auto shape2 = graph.addConstant(name + "_shape2", {1, rows, channels});
+            auto reshaped = graph.addNode("Reshape", {input, shape1}, name + "_reshape1");
+            auto transposed = graph.addNode("Transpose", {reshaped}, name + "_transpose", {makeAttribute("perm", std::vector<int64_t>{0, 3, 4, 1, 2})});
+            auto values = graph.addNode("Reshape", {transposed, shape2}, name + "_reshape2");
+
+            auto slice = [&](const std::string& suffix, int64_t start, int64_t end)
+            {
+                auto starts = graph.addConstant(name + "_" + suffix + "_starts", {start});
+                auto ends = graph.addConstant(name + "_" + suffix + "_ends", {end});
+                auto axes = graph.addConstant(name + "_" + suffix + "_axes", {2});
+                auto output = graph.addNode("Slice", {values, starts, ends, axes}, name + "_" + suffix);
+
+                // new_coords: logistic activation is already applied by the previous convolution
+                if(bNewCoords || suffix == "wh")
+                    return output;
+                else
+                    return graph.addNode("Sigmoid", {output}, output + "_sigmoid");
+            };
+
+            auto xy = slice("xy", 0, 2);
+            auto wh = slice("wh", 2, 4);
+            auto objectness = slice("obj", 4, 5);
+            auto probs = slice("cls", 5, channels);
+
+            auto scale = graph.addConstant(name + "_xy_scale", {2}, {scaleXY / gridW, scaleXY / gridH});
+            auto offsets = graph.addConstant(name + "_xy_offsets", {1, rows, 2}, grid);
+            auto sizes = graph.addConstant(name + "_wh_anchors", {1, rows, 2}, anchorSizes);
+            xy = graph.addNode("Mul", {xy, scale}, name + "_xy_scaled");
+            xy = graph.addNode("Add", {xy, offsets}, name + "_xy_decoded");
+
+            if(bNewCoords)
+                wh = graph.addNode("Mul", {wh, wh}, name + "_wh_square");
+            else
+                wh = graph.addNode("Exp", {wh}, name + "_wh_exp");
+
+            wh = graph.addNode("Mul", {wh, sizes}, name + "_wh_decoded");
+            auto scores = graph.addNode("Mul", {probs, objectness}, name + "_scores");
+
+            outputs[i] = graph.addNode("Concat", {xy, wh, objectness, scores}, "yolo_" + std::to_string(i), {makeAttribute("axis", (int64_t)2)});
+            graph.addOutput(outputs[i], {1, rows, channels});
+        }
+        else
+            throw CException(CoreExCode::NOT_IMPLEMENTED, "Unsupported darknet layer for ONNX export: [" + section.m_type + "]", __func__, __FILE__, __LINE__);
+    }
+
+    CProtoWriter opset;
+    opset.writeBytes(1, "");
+    opset.writeInt(2, 11);
+
+    CProtoWriter model;
+    model.writeInt(1, 6);
+    model.writeBytes(2, "ikomia_train_yolo");
+    model.writeMessage(8, opset);
+
+    // Graph holds all weights: written straight to file instead of copying it into the model message
+    std::ofstream file(onnxPath, std::ios::out | std::ios::binary | std::ios::trunc);
+    if(!file.is_open())
+        throw CException(CoreExCode::INVALID_FILE, "Unable to write ONNX file: " + onnxPath, __func__, __FILE__, __LINE__);
+
+    const std::string& graphData = graph.getProto().getData();
+    model.writeMessageHeader(7, graphData.size());
+    file.write(model.getData().data(), model.getData().size());
+    file.write(graphData.data(), graphData.size());
+
+    if(!file.good())
+        throw CException(CoreExCode::INVALID_FILE, "Error while writing ONNX file: " + onnxPath, __func__, __FILE__, __LINE__);
+}
+
+float CYoloOnnxExporter::checkEquivalence(const std::string &onnxPath, const std::string &imageListPath, size_t imageCount) const
+{
+    const auto& config = m_model.getConfig();
+    cv::Size inputSize(config.getNet().getInt("width", 416), config.getNet().getInt("height", 416));
+
+    // Output names are identical in both networks: yolo_<layer index>
+    std::vector<std::string> outputNames;
+    std::vector<int> channels;
+
+    for(size_t i=0; i<config.getLayerCount(); ++i)
+    {
+        if(config.getLayer(i).m_type == "yolo")
+        {
+            outputNames.push_back("yolo_" + std::to_string(i));
+            channels.push_back(5 + config.getLayer(i).getInt("classes", 0));
+        }
+    }
+
+    auto darknetNet = cv::dnn::readNetFromDarknet(m_cfgPath, m_weightsPath);
+    darknetNet.setPreferableBackend(cv::dnn::DNN_BACKEND_OPENCV);
+    darknetNet.setPreferableTarget(cv::dnn::DNN_TARGET_CPU);
+
+    auto onnxNet = cv::dnn::readNetFromONNX(onnxPath);
+    onnxNet.setPreferableBackend(cv::dnn::DNN_BACKEND_OPENCV);
+    onnxNet.setPreferableTarget(cv::dnn::DNN_TARGET_CPU);
+
+    std::ifstream listFile(imageListPath);
+    if(!listFile.is_open())
+        throw CException(CoreExCode::INVALID_FILE, "Unable to read image list: " + imageListPath, __func__, __FILE__, __LINE__);
+
+    std::string imagePath;
+    size_t checkedCount = 0;
+    float maxDiff = 0.0f;
+
+    while(checkedCount < imageCount && std::getline(listFile, imagePath))
+    {
+        cv::Mat image = cv::imread(imagePath, cv::IMREAD_COLOR);
+        if(image.empty())
+            continue;
+
+        cv::Mat blob = cv::dnn::blobFromImage(image, 1.0/255.0, inputSize, cv::Scalar(), true, false);
+        std::vector<cv::Mat> references, outputs;
+        darknetNet.setInput(blob);
+        darknetNet.forward(references, outputNames);
+        onnxNet.setInput(blob);
+        onnxNet.forward(outputs, outputNames);
+
+        for(size_t i=0; i<outputNames.size(); ++i)
+        {
+            if(references[i].total() != outputs[i].total())
+                throw CException(CoreExCode::INVALID_SIZE, "ONNX output size mismatch for " + outputNames[i], __func__, __FILE__, __LINE__);
+
+            const float* pReference = references[i].ptr<float>();
+            const float* pOutput = outputs[i].ptr<float>();
+
+            for(size_t j=0; j<references[i].total(); ++j)
+            {
+                // OpenCV region layer zeroes low class scores
+                if((int)(j % channels[i]) >= 5 && pReference[j] == 0.0f)
+                    continue;
+
+                maxDiff = std::max(maxDiff, std::abs(pReference[j] - pOutput[j]));
+            }
+        }
+        checkedCount++;
+    }
+
+    if(checkedCount == 0)
+        throw CException(CoreExCode::INVALID_FILE, "No readable image for ONNX equivalence check in " + imageListPath, __func__, __FILE__, __LINE__);
+
+    return maxDiff;
+}
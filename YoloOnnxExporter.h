@@ -0,0 +1,32 @@
+#ifndef YOLOONNXEXPORTER_H
+#define YOLOONNXEXPORTER_H
+
+#include "DarknetModel.h"
+
+//-----------------------------//
+//----- CYoloOnnxExporter -----//
+//-----------------------------//
+// Convert darknet YOLO models to ONNX (opset 11), batch normalization is folded into convolutions.
+// Input "images": [1, 3, height, width] RGB in [0, 1], resized without letterbox.
+// Each [yolo] layer gives a decoded output "yolo_<index>" of shape [1, height*width*anchors, 5+classes]:
+// box center and size normalized by input size, objectness, objectness x class probabilities.
+// Rows are ordered like OpenCV DNN darknet outputs (y, x, anchor).
+class YOLOTRAIN_EXPORT CYoloOnnxExporter
+{
+    public:
+
+        CYoloOnnxExporter(const std::string& cfgPath, const std::string& weightsPath);
+
+        void    exportModel(const std::string& onnxPath) const;
+
+        // Maximum absolute difference between ONNX and darknet [yolo] outputs, both computed by OpenCV DNN on CPU
+        float   checkEquivalence(const std::string& onnxPath, const std::string& imageListPath, size_t imageCount) const;
+
+    private:
+
+        std::string     m_cfgPath;
+        std::string     m_weightsPath;
+        CDarknetModel   m_model;
+};
+
+#endif // YOLOONNXEXPORTER_H
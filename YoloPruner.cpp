@@ -0,0 +1,306 @@
+#include <algorithm>
+#include <cmath>
+#include "YoloPruner.h"
+#include "Main/CoreTools.hpp"
+
+//-----------------------//
+//----- CYoloPruner -----//
+//-----------------------//
+CYoloPruner::CYoloPruner(CDarknetModel &model) : m_model(model)
+{
+}
+
+void CYoloPruner::setMinChannelRatio(float ratio)
+{
+    m_minChannelRatio = ratio;
+}
+
+double CYoloPruner::prune(double targetReduction)
+{
+    buildLayouts();
+
+    auto& config = m_model.getConfig();
+    const size_t layerCount = m_model.getLayerCount();
+    const double baseFlops = m_model.computeFlops();
+
+    struct Candidate
+    {
+        float   m_gamma;
+        int     m_layer;
+        int     m_channel;
+    };
+    std::vector<Candidate> candidates;
+    std::vector<std::vector<bool>> keepMasks(layerCount);
+    std::vector<int> keptOut(layerCount, 0), keptIn(layerCount, 0), minKept(layerCount, 0);
+    // FLOPs of one input-output channel pair
+    std::vector<double> pairCosts(layerCount, 0.0);
+
+    for(size_t i=0; i<layerCount; ++i)
+    {
+        const auto& section = config.getLayer(i);
+        if(section.m_type != "convolutional")
+            continue;
+
+        const auto& layer = m_model.getLayer(i);
+        int size = section.getInt("size", 1);
+        keepMasks[i].assign(layer.m_outC, true);
+        keptOut[i] = layer.m_outC;
+        keptIn[i] = layer.m_inC;
+        minKept[i] = std::max(1, (int)std::ceil(m_minChannelRatio * layer.m_outC));
+        pairCosts[i] = 2.0 * layer.m_outW * layer.m_outH * size * size;
+
+        if(m_bPrunable[i])
+        {
+            for(int c=0; c<layer.m_outC; ++c)
+                candidates.push_back({std::abs(layer.m_scales[c]), (int)i, c});
+        }
+    }
+
+    std::sort(candidates.begin(), candidates.end(), [](const Candidate& c1, const Candidate& c2)
+    {
+        return c1.m_gamma < c2.m_gamma;
+    });
+
+    // Prunable convolutions have no group: FLOPs variation is exact
+    double removedFlops = 0.0;
+    const double targetFlops = targetReduction * baseFlops;
+
+    for(auto&& candidate : candidates)
+    {
+        if(removedFlops >= targetFlops)
+            break;
+
+        const int l = candidate.m_layer;
+        if(keptOut[l] <= minKept[l])
+            continue;
+
+        removedFlops += pairCosts[l] * keptIn[l];
+        for(auto&& consumer : m_consumers[l])
+        {
+            int groups = config.getLayer(consumer).getInt("groups", 1);
+            removedFlops += pairCosts[consumer] * keptOut[consumer] / groups;
+            keptIn[consumer]--;
+        }
+        keepMasks[l][candidate.m_channel] = false;
+        keptOut[l]--;
+    }
+
+    apply(keepMasks);
+    return 1.0 - m_model.computeFlops() / baseFlops;
+}
+
+void CYoloPruner::buildLayouts()
+{
+    const auto& config = m_model.getConfig();
+    const size_t layerCount = m_model.getLayerCount();
+    const Layout imageLayout = {{-1, config.getNet().getInt("channels", 3)}};
+    m_layouts.assign(layerCount, Layout());
+    m_bPrunable.assign(layerCount, false);
+    m_consumers.assign(layerCount, std::vector<int>());
+
+    for(size_t i=0; i<layerCount; ++i)
+    {
+        const auto& section = config.getLayer(i);
+        const auto& layer = m_model.getLayer(i);
+        const Layout& inputLayout = i == 0 ? imageLayout : m_layouts[i-1];
+        const Layout fixedLayout = {{-1, layer.m_outC}};
+
+        if(section.m_type == "convolutional")
+        {
+            float y;
+            int groups = section.getInt("groups", 1);
+            m_bPrunable[i] = section.getInt("batch_normalize", 0) && groups == 1 && activate(section.get("activation", "logistic"), 0.0f, y);
+
+            if(groups > 1)
+                markFixed(inputLayout);
+
+            for(auto&& segment : inputLayout)
+            {
+                if(segment.m_source >= 0)
+                    m_consumers[segment.m_source].push_back((int)i);
+            }
+            m_layouts[i] = {{(int)i, layer.m_outC}};
+        }
+        else if(section.m_type == "maxpool" || section.m_type == "upsample" || section.m_type == "dropout")
+            m_layouts[i] = inputLayout;
+        else if(section.m_type == "route")
+        {
+            auto refs = config.getLayerRefs(i, "layers");
+            if(section.getInt("groups", 1) > 1)
+            {
+                for(auto&& ref : refs)
+                    markFixed(m_layouts[ref]);
+
+                m_layouts[i] = fixedLayout;
+            }
+            else
+            {
+                for(auto&& ref : refs)
+                    m_layouts[i].insert(m_layouts[i].end(), m_layouts[ref].begin(), m_layouts[ref].end());
+            }
+        }
+        else if(section.m_type == "shortcut" || section.m_type == "scale_channels")
+        {
+            markFixed(inputLayout);
+            for(auto&& ref : config.getLayerRefs(i, "from"))
+                markFixed(m_layouts[ref]);
+
+            m_layouts[i] = fixedLayout;
+        }
+        else
+        {
+            // [avgpool], [yolo] and any other layer consume the whole input
+            markFixed(inputLayout);
+            m_layouts[i] = fixedLayout;
+        }
+    }
+}
+
+void CYoloPruner::markFixed(const Layout &layout)
+{
+    for(auto&& segment : layout)
+    {
+        if(segment.m_source >= 0)
+            m_bPrunable[segment.m_source] = false;
+    }
+}
+
+void CYoloPruner::apply(const std::vector<std::vector<bool>> &keepMasks)
+{
+    auto& config = m_model.getConfig();
+    const size_t layerCount = m_model.getLayerCount();
+    const Layout imageLayout = {{-1, config.getNet().getInt("channels", 3)}};
+
+    // Constant outputs of removed channels, computed before any modification
+    std::vector<std::vector<float>> constants(layerCount);
+    for(size_t i=0; i<layerCount; ++i)
+    {
+        if(!m_bPrunable[i])
+            continue;
+
+        const auto& layer = m_model.getLayer(i);
+        auto activation = config.getLayer(i).get("activation", "logistic");
+        constants[i].resize(layer.m_outC);
+
+        for(int c=0; c<layer.m_outC; ++c)
+            activate(activation, layer.m_biases[c], constants[i][c]);
+    }
+
+    for(size_t i=0; i<layerCount; ++i)
+    {
+        auto& section = config.getLayer(i);
+        if(section.m_type != "convolutional")
+            continue;
+
+        auto& layer = m_model.getLayer(i);
+        const int size = section.getInt("size", 1);
+        const int kernelSize = size * size;
+        const int groups = section.getInt("groups", 1);
+        const int inPerGroup = layer.m_inC / groups;
+
+        // Input channels: kept ones and constant value of removed ones
+        std::vector<int> keptInputs;
+        std::vector<std::pair<int, float>> removedInputs;
+        int channel = 0;
+
+        for(auto&& segment : i == 0 ? imageLayout : m_layouts[i-1])
+        {
+            for(int c=0; c<segment.m_count; ++c, ++channel)
+            {
+                if(segment.m_source < 0 || keepMasks[segment.m_source][c])
+                    keptInputs.push_back(channel);
+                else
+                    removedInputs.push_back(std::make_pair(channel, constants[segment.m_source][c]));
+            }
+        }
+
+        std::vector<int> keptOutputs;
+        for(int c=0; c<layer.m_outC; ++c)
+        {
+            if(keepMasks[i][c])
+                keptOutputs.push_back(c);
+        }
+
+        if(removedInputs.empty() && (int)keptOutputs.size() == layer.m_outC)
+            continue;
+
+        // Grouped convolutions never lose input channels (see buildLayouts)
+        if(groups > 1 && !removedInputs.empty())
+            throw CException(CoreExCode::INVALID_PARAMETER, "Invalid pruning of grouped convolution input.", __func__, __FILE__, __LINE__);
+
+        std::vector<float> weights, biases, scales, means, variances;
+        for(auto&& o : keptOutputs)
+        {
+            const float* pKernels = layer.m_weights.data() + (size_t)o * inPerGroup * kernelSize;
+            double offset = 0.0;
+
+            for(auto&& removed : removedInputs)
+            {
+                const float* pKernel = pKernels + (size_t)removed.first * kernelSize;
+                for(int k=0; k<kernelSize; ++k)
+                    offset += pKernel[k] * removed.second;
+            }
+
+            if(groups > 1)
+                weights.insert(weights.end(), pKernels, pKernels + inPerGroup * kernelSize);
+            else
+            {
+                for(auto&& in : keptInputs)
+                    weights.insert(weights.end(), pKernels + (size_t)in * kernelSize, pKernels + (size_t)(in + 1) * kernelSize);
+            }
+
+            if(layer.m_scales.empty())
+                biases.push_back(layer.m_biases[o] + (float)offset);
+            else
+            {
+                biases.push_back(layer.m_biases[o]);
+                scales.push_back(layer.m_scales[o]);
+                means.push_back(layer.m_rollingMean[o] - (float)offset);
+                variances.push_back(layer.m_rollingVariance[o]);
+            }
+        }
+
+        layer.m_weights = weights;
+        layer.m_biases = biases;
+        layer.m_scales = scales;
+        layer.m_rollingMean = means;
+        layer.m_rollingVariance = variances;
+        section.set("filters", std::to_string(keptOutputs.size()));
+    }
+
+    // Consistency check between new config and weights
+    m_model.updateShapes();
+    for(size_t i=0; i<layerCount; ++i)
+    {
+        const auto& section = config.getLayer(i);
+        if(section.m_type != "convolutional")
+            continue;
+
+        const auto& layer = m_model.getLayer(i);
+        int size = section.getInt("size", 1);
+        size_t expected = (size_t)layer.m_outC * (layer.m_inC / section.getInt("groups", 1)) * size * size;
+
+        if(layer.m_weights.size() != expected || (int)layer.m_biases.size() != layer.m_outC)
+            throw CException(CoreExCode::INVALID_SIZE, "Inconsistent pruned weights for layer " + std::to_string(i), __func__, __FILE__, __LINE__);
+    }
+}
+
+bool CYoloPruner::activate(const std::string &activation, float x, float &y)
+{
+    if(activation == "linear")
+        y = x;
+    else if(activation == "leaky")
+        y = x > 0 ? x : 0.1f * x;
+    else if(activation == "relu")
+        y = std::max(0.0f, x);
+    else if(activation == "logistic")
+        y = 1.0f / (1.0f + std::exp(-x));
+    else if(activation == "swish")
+        y = x / (1.0f + std::exp(-x));
+    else if(activation == "mish")
+        y = x * std::tanh(std::log1p(std::exp(x)));
+    else
+        return false;
+
+    return true;
+}
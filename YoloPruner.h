@@ -0,0 +1,57 @@
+#ifndef YOLOPRUNER_H
+#define YOLOPRUNER_H
+
+#include "DarknetModel.h"
+
+//-----------------------//
+//----- CYoloPruner -----//
+//-----------------------//
+// Structured channel pruning of darknet models (network slimming).
+// Channels of batch-normalized convolutions are ranked by |gamma| and removed globally,
+// lowest first, until the target FLOPs reduction is reached.
+// Channels tied by shortcut, scale_channels, grouped route or grouped convolution are kept,
+// as well as inputs of [yolo] layers. A removed channel is approximated by its output for gamma = 0,
+// i.e. the constant activation of beta, folded into the consumers rolling mean (or bias without batch normalization).
+// The approximation is exact only for channels whose gamma is close to 0 (away from zero-padded borders):
+// without sparsity training, small |gamma| does not guarantee it and a short fine-tune recovers the accuracy drop.
+class YOLOTRAIN_EXPORT CYoloPruner
+{
+    public:
+
+        CYoloPruner(CDarknetModel& model);
+
+        void    setMinChannelRatio(float ratio);
+
+        // Return achieved FLOPs reduction ratio
+        double  prune(double targetReduction);
+
+    private:
+
+        struct Segment
+        {
+            // Source convolution of the channels, -1 if channels can't be pruned
+            int m_source = -1;
+            int m_count = 0;
+        };
+        using Layout = std::vector<Segment>;
+
+        void    buildLayouts();
+
+        void    markFixed(const Layout& layout);
+
+        void    apply(const std::vector<std::vector<bool>>& keepMasks);
+
+        static bool     activate(const std::string& activation, float x, float& y);
+
+    private:
+
+        CDarknetModel&                  m_model;
+        float                           m_minChannelRatio = 0.1f;
+        // Channel layout of each layer output
+        std::vector<Layout>             m_layouts;
+        std::vector<bool>               m_bPrunable;
+        // Convolutions consuming channels of each convolution
+        std::vector<std::vector<int>>   m_consumers;
+};
+
+#endif // YOLOPRUNER_H
@@ -0,0 +1,107 @@
+// Headless YOLO training driver.
+// Usage: train_yolo_cli <dataset.json> [parameters.json]
+// - dataset.json: Ikomia dataset as serialized by CDatasetIO::save()
+// - parameters.json: flat object of CYoloTrainParam values, missing keys keep their default
+#include <Python.h>
+#include <csignal>
+#include <iostream>
+#include <QCoreApplication>
+#include <QFile>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include "YoloTrainProcess.h"
+#include "IO/CDatasetIO.h"
+
+namespace
+{
+    std::shared_ptr<CYoloTrain> _taskPtr = nullptr;
+    volatile std::sig_atomic_t _bInterrupted = 0;
+
+    // Stop is cooperative: training ends properly and already produced files are kept
+    void onInterrupt(int)
+    {
+        _bInterrupted = 1;
+        if(_taskPtr)
+            _taskPtr->stop();
+    }
+
+    void loadParameters(const QString& path, std::shared_ptr<CYoloTrainParam>& paramPtr)
+    {
+        QFile file(path);
+        if(file.open(QFile::ReadOnly | QFile::Text) == false)
+            throw CException(CoreExCode::INVALID_FILE, "Unable to read parameters file: " + path.toStdString(), __func__, __FILE__, __LINE__);
+
+        QJsonDocument json = QJsonDocument::fromJson(file.readAll());
+        if(json.isObject() == false)
+            throw CException(CoreExCode::INVALID_JSON_FORMAT, "Parameters file must contain a JSON object.", __func__, __FILE__, __LINE__);
+
+        QJsonObject root = json.object();
+        for(auto it=root.begin(); it!=root.end(); ++it)
+        {
+            auto key = it.key().toStdString();
+            if(paramPtr->m_cfg.find(key) == paramPtr->m_cfg.end())
+                std::cerr << "Unknown parameter ignored: " << key << std::endl;
+            else if(it.value().isBool())
+                paramPtr->m_cfg[key] = std::to_string(it.value().toBool());
+            else
+                paramPtr->m_cfg[key] = it.value().toVariant().toString().toStdString();
+        }
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    auto args = app.arguments();
+
+    if(args.size() < 2 || args.size() > 3)
+    {
+        std::cerr << "Usage: train_yolo_cli <dataset.json> [parameters.json]" << std::endl;
+        return 2;
+    }
+
+    // MLflow logging goes through Python, from the main thread and from asynchronous logging threads:
+    // the GIL is released as in Ikomia application, calls into Python acquire it themselves
+    Py_Initialize();
+    PyThreadState* pMainThreadState = PyEval_SaveThread();
+    int exitCode = 0;
+
+    try
+    {
+        auto paramPtr = std::make_shared<CYoloTrainParam>();
+        if(args.size() == 3)
+            loadParameters(args[2], paramPtr);
+
+        auto datasetPtr = std::make_shared<CDatasetIO>();
+        datasetPtr->CDatasetIO::load(args[1].toStdString());
+
+        CYoloTrainFactory factory;
+        _taskPtr = std::dynamic_pointer_cast<CYoloTrain>(factory.create(paramPtr));
+        _taskPtr->setInput(datasetPtr, 0);
+
+        QObject::connect(_taskPtr->getSignalRawPtr(), &CSignalHandler::doLog, [](const QString& msg)
+        {
+            std::cout << msg.toStdString() << std::endl;
+        });
+
+        std::signal(SIGINT, onInterrupt);
+        std::signal(SIGTERM, onInterrupt);
+        _taskPtr->run();
+
+        if(_bInterrupted)
+            exitCode = 130;
+    }
+    catch(std::exception& e)
+    {
+        std::cerr << e.what() << std::endl;
+        exitCode = 1;
+    }
+
+    std::signal(SIGINT, SIG_DFL);
+    std::signal(SIGTERM, SIG_DFL);
+    _taskPtr = nullptr;
+
+    PyEval_RestoreThread(pMainThreadState);
+    Py_Finalize();
+    return exitCode;
+}
@@ -5,6 +5,8 @@
 
 #if defined(YOLOTRAIN_LIBRARY)
 #  define YOLOTRAIN_EXPORT Q_DECL_EXPORT
+#elif defined(YOLOTRAIN_STATIC)
+#  define YOLOTRAIN_EXPORT
 #else
 #  define YOLOTRAIN_EXPORT Q_DECL_IMPORT
 #endif
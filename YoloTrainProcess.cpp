@@ -1,8 +1,19 @@
 #include <QJsonObject>
 #include <QJsonArray>
+#include <thread>
+#include <fstream>
+#include <numeric>
+#include <cmath>
+#include <cctype>
 #include "YoloTrainProcess.h"
 #include "IO/CDatasetIO.h"
 #include "UtilsTools.hpp"
+#include "YoloEvaluator.h"
+#include "YoloPruner.h"
+#include "YoloOnnxExporter.h"
+#ifdef TRAINYOLO_WITH_LIBDARKNET
+#include "DarknetEngine.h"
+#endif
 
 using namespace boost::python;
 
@@ -54,6 +65,41 @@ CYoloTrainParam::CYoloTrainParam() : CWorkflowTaskParam()
     m_cfg["autoConfig"] = std::to_string(true);
     m_cfg["configPath"] = "";
     m_cfg["outputPath"] = pluginDir + "data/models";;
+    // Evaluate checkpoints with OpenCV DNN on CPU instead of darknet -map option
+    m_cfg["nativeEval"] = std::to_string(false);
+    // Training engine: darknet executable (process) or in-process libdarknet (library)
+    m_cfg["engine"] = "process";
+    // Parallel workers for native evaluation (0 = CPU count): each worker loads its own network
+    // and competes with darknet data loading threads, keep it small
+    m_cfg["evalWorkers"] = "2";
+    // Passes over training set between two in-training mAP computations
+    m_cfg["evalPeriod"] = "4";
+    // Maximum images of the in-training evaluation set (0 = whole evaluation set)
+    m_cfg["evalSubsetSize"] = "0";
+    // Post-training selection of the best checkpoint among all saved weights
+    m_cfg["selectBest"] = std::to_string(false);
+    // Ranking metric: mAP50 or mAP50-95
+    m_cfg["selectionMetric"] = "mAP50";
+    // Maximum inference time per image in ms (0 = no limit), checked once per config with a warning if exceeded
+    m_cfg["latencyBudget"] = "0";
+    // Checkpoints evaluated concurrently, i.e. models loaded in memory
+    m_cfg["selectionWorkers"] = "2";
+    // Post-training channel pruning: target FLOPs reduction ratio (0 = no pruning)
+    m_cfg["pruneRatio"] = "0";
+    // Darknet fine-tune iterations of the pruned model (0 = no fine-tune)
+    m_cfg["pruneFinetuneIterations"] = "0";
+    // Export final model to ONNX
+    m_cfg["exportOnnx"] = std::to_string(false);
+    // Images of eval set used to check ONNX outputs against darknet (0 = no check)
+    m_cfg["onnxCheckImages"] = "8";
+    // Copy dataset files into the run folder when they can't be linked (other device without link support)
+    m_cfg["allowCopy"] = std::to_string(false);
+    // Iterations budget (auto configuration): classes (2000 per class) or dataset (passes over training images)
+    m_cfg["scheduleMode"] = "classes";
+    // Passes over training set for dataset schedule mode
+    m_cfg["trainPasses"] = "100";
+    // Learning rate policy (auto configuration): steps, cosine or one_cycle
+    m_cfg["lrPolicy"] = "steps";
 }
 
 //----------------------//
@@ -104,14 +150,44 @@ void CYoloTrain::run()
         throw CException(CoreExCode::INVALID_PARAMETER, "Invalid model, available models are: " + models, __func__, __FILE__, __LINE__);
     }
 
-    // Dataset preparation
-    prepareData();
-    beginTaskRun();
-    emit m_signalHandler->doAddSubTotalSteps(std::stoi(paramPtr->m_cfg["epochs"]) - 1);
+    // Stop request applies to the whole run (training, selection, pruning and export), cleared at its start only
+    m_bStop = false;
+
+    // Run folder is removed whatever the outcome
+    try
+    {
+        // Dataset preparation
+        prepareData();
+        beginTaskRun();
+        emit m_signalHandler->doAddSubTotalSteps(std::stoi(paramPtr->m_cfg["epochs"]) - 1);
+
+        // Launch training
+        m_stepOffset = 0;
+        auto configPath = paramPtr->m_cfg["configPath"];
+        bool bCompleted = launchTraining(QString::fromStdString(configPath), getPretrainedWeights());
+
+        if(bCompleted && std::stoi(paramPtr->m_cfg["selectBest"]))
+            selectBestCheckpoint(configPath);
+
+        // Selection may have been interrupted: pruning would use a partial evaluation
+        if(bCompleted && !m_bStop && std::stod(paramPtr->m_cfg["pruneRatio"]) > 0)
+            pruneModel(configPath);
 
-    // Launch training
-    launchTraining();
+        if(bCompleted && !m_bStop && std::stoi(paramPtr->m_cfg["exportOnnx"]))
+            exportOnnxModel(configPath);
 
+        // Generated config is removed with the run folder, a copy is kept with the models
+        if(std::stoi(paramPtr->m_cfg["autoConfig"]))
+            paramPtr->m_cfg["configPath"] = m_outputFolder.toStdString() + "/" + boost::filesystem::path(configPath).filename().string();
+    }
+    catch(...)
+    {
+        deleteRunFolder();
+        throw;
+    }
+    deleteRunFolder();
+
+    emit m_signalHandler->doLog("YOLO training finished!");
     emit m_signalHandler->doProgress();
     endTaskRun();
 }
@@ -131,25 +207,27 @@ void CYoloTrain::prepareData()
     if(paramPtr == nullptr)
         throw CException(CoreExCode::INVALID_PARAMETER, "Invalid parameters", __func__, __FILE__, __LINE__);
 
-    //Delete files from previous training
-    deleteTrainingFiles();
-
     std::string pluginDir = Utils::Plugin::getCppPath() + "/" + Utils::File::conformName(QString::fromStdString(m_name)).toStdString() + "/";
 
+    // Run folders: models in output path, every generated file (lists, config, metrics, image links and labels)
+    // in plugin data so that source dataset is never modified and concurrent trainings don't share any file
+    auto runName = Utils::File::conformName(QDateTime::currentDateTime().toString(Qt::ISODate));
+    m_outputFolder = createRunFolder(QString::fromStdString(paramPtr->m_cfg["outputPath"]), runName);
+    m_dataFolder = createRunFolder(QString::fromStdString(pluginDir) + "data/runs", QFileInfo(m_outputFolder).fileName());
+
     // Serialize dataset information from Python struture of IkDatasetIO
-    std::string jsonFile = pluginDir + "data/dataset.json";
+    std::string jsonFile = m_dataFolder.toStdString() + "/dataset.json";
     datasetInputPtr->save(jsonFile);
 
     // Read back the dataset as json
     datasetInputPtr->CDatasetIO::load(jsonFile);
     QJsonDocument json = datasetInputPtr->getJsonDocument();
 
-    // Create dataset text annotation files
-    if(datasetInputPtr->getSourceFormat() != "yolo")
-        createAnnotationFiles(json);
+    // Create dataset text annotation files, YOLO datasets already have them
+    createAnnotationFiles(json, datasetInputPtr->getSourceFormat() == "yolo");
 
     // Split train-eval
-    splitTrainEval(json, std::stof(paramPtr->m_cfg["splitRatio"]));
+    splitTrainEval(json, std::stof(paramPtr->m_cfg["splitRatio"]), std::stoul(paramPtr->m_cfg["evalSubsetSize"]));
 
     // Create class names file
     createClassNamesFile(json);
@@ -168,7 +246,7 @@ void CYoloTrain::prepareData()
     paramPtr->m_cfg["classes"] = std::to_string(m_classCount);
 }
 
-void CYoloTrain::createAnnotationFiles(const QJsonDocument &json) const
+void CYoloTrain::createAnnotationFiles(const QJsonDocument &json, bool bLinkLabels)
 {
     QJsonObject root = json.object();
     auto itImages = root.find("images");
@@ -179,13 +257,36 @@ void CYoloTrain::createAnnotationFiles(const QJsonDocument &json) const
     if(itImages.value().isArray() == false)
         throw CException(CoreExCode::INVALID_JSON_FORMAT, "Invalid dataset structure.", __func__, __FILE__, __LINE__);
 
+    // Darknet finds label file next to the image: each image is linked into the run folder
+    // with its label file beside. Index prefix avoids name collisions between source folders.
+    auto paramPtr = std::dynamic_pointer_cast<CYoloTrainParam>(m_pParam);
+    bool bAllowCopy = std::stoi(paramPtr->m_cfg["allowCopy"]);
+    std::string imageFolder = m_dataFolder.toStdString() + "/images";
+    Utils::File::createDirectory(imageFolder);
     auto images = itImages.value().toArray();
-    for(auto&& imgRef : images)
+    size_t copyCount = 0;
+    m_imagePaths.clear();
+
+    for(int i=0; i<images.size(); ++i)
     {
-        auto img = imgRef.toObject();
+        auto img = images[i].toObject();
         auto imgFile = img["filename"].toString();
         boost::filesystem::path imgPath(imgFile.toStdString());
-        std::string txtFilePath = imgPath.parent_path().string() + "/" + imgPath.stem().string() + ".txt";
+        std::string name = std::to_string(i) + "_" + imgPath.stem().string();
+        std::string linkPath = imageFolder + "/" + name + imgPath.extension().string();
+        std::string txtFilePath = imageFolder + "/" + name + ".txt";
+        copyCount += !linkFile(imgPath.string(), linkPath, bAllowCopy);
+        m_imagePaths.push_back(linkPath);
+
+        if(bLinkLabels)
+        {
+            std::string srcTxtFilePath = imgPath.parent_path().string() + "/" + imgPath.stem().string() + ".txt";
+            if(Utils::File::isFileExist(srcTxtFilePath))
+                copyCount += !linkFile(srcTxtFilePath, txtFilePath, bAllowCopy);
+
+            continue;
+        }
+
         QFile txtFile(QString::fromStdString(txtFilePath));
 
         if(txtFile.open(QFile::WriteOnly | QFile::Text))
@@ -213,11 +314,13 @@ void CYoloTrain::createAnnotationFiles(const QJsonDocument &json) const
             txtFile.close();
         }
     }
+
+    if(copyCount > 0)
+        emit m_signalHandler->doLog(QString("Warning: %1 dataset files could not be linked and were copied into %2").arg(copyCount).arg(QString::fromStdString(imageFolder)));
 }
 
 void CYoloTrain::createClassNamesFile(const QJsonDocument &json)
 {
-    std::string pluginDir = Utils::Plugin::getCppPath() + "/" + Utils::File::conformName(QString::fromStdString(m_name)).toStdString() + "/";
     QJsonObject root = json.object();
     auto itMetadata = root.find("metadata");
 
@@ -244,54 +347,70 @@ void CYoloTrain::createClassNamesFile(const QJsonDocument &json)
         names[id] = it.value().toString();
     }
 
-    std::string path = pluginDir + "data/classes.txt";
+    std::string path = m_dataFolder.toStdString() + "/classes.txt";
     QFile classFile(QString::fromStdString(path));
 
     if(classFile.open(QFile::WriteOnly | QFile::Text) == false)
         throw CException(CoreExCode::INVALID_FILE, "Unable to create file classes.txt", __func__, __FILE__, __LINE__);
 
     QTextStream stream(&classFile);
+    m_classNames.clear();
     for(int i=0; i<names.size(); ++i)
+    {
         stream << names[i] << "\n";
+        m_classNames.push_back(names[i].toStdString());
+    }
 
     classFile.close();
 }
 
 void CYoloTrain::createGlobalDataFile()
 {
-    auto paramPtr = std::dynamic_pointer_cast<CYoloTrainParam>(m_pParam);
-    QString pluginDir = QString::fromStdString(Utils::Plugin::getCppPath()) + "/" + Utils::File::conformName(QString::fromStdString(m_name)) + "/";
-    QString path = pluginDir + "data/training.data";
+    QString path = m_dataFolder + "/training.data";
     QFile file(path);
 
     if(file.open(QFile::WriteOnly | QFile::Text) == false)
         throw CException(CoreExCode::INVALID_FILE, "Unable to create file classes.txt", __func__, __FILE__, __LINE__);
 
-    m_outputFolder = QString::fromStdString(paramPtr->m_cfg["outputPath"]) + "/" + Utils::File::conformName(QDateTime::currentDateTime().toString(Qt::ISODate));
-    Utils::File::createDirectory(m_outputFolder.toStdString());
-
     QTextStream stream(&file);
     stream << "classes = " << m_classCount << "\n";
-    stream << "train = " << pluginDir + "data/train.txt\n";
-    stream << "valid = " << pluginDir + "data/eval.txt\n";
-    stream << "names = " << pluginDir + "data/classes.txt\n";
+    stream << "train = " << m_dataFolder + "/train.txt\n";
+    stream << "valid = " << m_validListPath << "\n";
+    stream << "names = " << m_dataFolder + "/classes.txt\n";
     stream << "backup = " << m_outputFolder << "\n";
-    stream << "metrics = " << pluginDir + "data/metrics.txt";
+    stream << "metrics = " << m_dataFolder + "/metrics.txt";
 }
 
 void CYoloTrain::createConfigFile()
 {
     auto paramPtr = std::dynamic_pointer_cast<CYoloTrainParam>(m_pParam);
-    int epochs = m_classCount * 2000;
+    std::string scheduleMode = paramPtr->m_cfg["scheduleMode"];
+    int epochs, burnin;
+
+    if(scheduleMode == "dataset")
+    {
+        // One darknet iteration processes one batch: compute is proportional to the training set size
+        int batchSize = std::max(1, std::stoi(paramPtr->m_cfg["batchSize"]));
+        double passIterations = (double)m_trainImageCount / batchSize;
+        epochs = std::max(1, (int)std::ceil(std::stod(paramPtr->m_cfg["trainPasses"]) * passIterations));
+        // Warm-up over the first 3 passes, at most 10% of the budget
+        burnin = std::min((int)std::ceil(3 * passIterations), epochs / 10);
+    }
+    else if(scheduleMode == "classes")
+    {
+        epochs = m_classCount * 2000;
+        burnin = (int)(epochs * 0.05);
+    }
+    else
+        throw CException(CoreExCode::INVALID_PARAMETER, "Invalid schedule mode, available modes are: classes,dataset", __func__, __FILE__, __LINE__);
+
     paramPtr->m_cfg["epochs"] = std::to_string(epochs);
-    int burnin = (int)(epochs * 0.05);
-    int step1 = (int)(epochs * 0.8);
-    int step2 = (int)(epochs * 0.9);
+    QString schedule = createSchedule(epochs, burnin);
     int filters = (m_classCount + 5) * 3;
 
     QString pluginDir = QString::fromStdString(Utils::Plugin::getCppPath()) + "/" + Utils::File::conformName(QString::fromStdString(m_name)) + "/";
     QString templatePath = pluginDir + "data/config/" + _modelConfigFiles[QString::fromStdString(paramPtr->m_cfg["model"])];
-    QString configPath = pluginDir + "data/config/training.cfg";
+    QString configPath = m_dataFolder + "/training.cfg";
     paramPtr->m_cfg["configPath"] = configPath.toStdString();
 
     QFile templateFile(templatePath);
@@ -311,7 +430,7 @@ void CYoloTrain::createConfigFile()
     newContent = newContent.replace("_lr_", QString::fromStdString(paramPtr->m_cfg["learningRate"]));
     newContent = newContent.replace("_burnin_", QString::number(burnin));
     newContent = newContent.replace("_epochs_", QString::fromStdString(paramPtr->m_cfg["epochs"]));
-    newContent = newContent.replace("_steps_", QString::number(step1)+ "," + QString::number(step2));
+    newContent = newContent.replace("_schedule_", schedule);
     newContent = newContent.replace("_filters_", QString::number(filters));
     newContent = newContent.replace("_classes_", QString::number(m_classCount));
 
@@ -324,6 +443,53 @@ void CYoloTrain::createConfigFile()
     configFile.close();
 }
 
+QString CYoloTrain::createSchedule(int iterations, int &burnin) const
+{
+    auto paramPtr = std::dynamic_pointer_cast<CYoloTrainParam>(m_pParam);
+    std::string policy = paramPtr->m_cfg["lrPolicy"];
+    const double minRatio = 0.01;
+    QStringList lines;
+
+    if(policy == "steps")
+    {
+        lines << "policy=steps";
+        lines << QString("steps=%1,%2").arg((int)(iterations * 0.8)).arg((int)(iterations * 0.9));
+        lines << "scales=.1,.1";
+    }
+    else if(policy == "cosine")
+    {
+        // Darknet SGDR with a single cycle over the whole training
+        lines << "policy=sgdr";
+        lines << QString("sgdr_cycle=%1").arg(iterations);
+        lines << "sgdr_mult=1";
+        lines << QString("learning_rate_min=%1").arg(std::stod(paramPtr->m_cfg["learningRate"]) * minRatio);
+    }
+    else if(policy == "one_cycle")
+    {
+        // Darknet has no one-cycle policy: linear warm-up over 30% of the budget (burn_in with power=1),
+        // then cosine annealing approximated by steps. Momentum stays constant.
+        const int stepCount = 10;
+        const double pi = std::acos(-1.0);
+        auto factor = [&](double t){ return minRatio + (1.0 - minRatio) * 0.5 * (1.0 + std::cos(pi * t)); };
+        QStringList steps, scales;
+        burnin = (int)(iterations * 0.3);
+
+        for(int i=1; i<stepCount; ++i)
+        {
+            steps << QString::number(burnin + (int)std::round((iterations - burnin) * (double)i / stepCount));
+            scales << QString::number(factor((double)i / stepCount) / factor((double)(i - 1) / stepCount), 'g', 4);
+        }
+        lines << "policy=steps";
+        lines << "power=1";
+        lines << "steps=" + steps.join(",");
+        lines << "scales=" + scales.join(",");
+    }
+    else
+        throw CException(CoreExCode::INVALID_PARAMETER, "Invalid learning rate policy, available policies are: steps,cosine,one_cycle", __func__, __FILE__, __LINE__);
+
+    return lines.join("\n");
+}
+
 void CYoloTrain::updateParamFromConfigFile()
 {
     auto paramPtr = std::dynamic_pointer_cast<CYoloTrainParam>(m_pParam);
@@ -396,9 +562,59 @@ void CYoloTrain::updateParamFromConfigFile()
         paramPtr->m_cfg["epochs"] = match.captured(1).toStdString();
 }
 
-void CYoloTrain::splitTrainEval(const QJsonDocument &json, float ratio)
+bool CYoloTrain::linkFile(const std::string &source, const std::string &target, bool bAllowCopy) const
+{
+    // Symbolic link first, hard link where symbolic links are not allowed (Windows without privilege),
+    // copy only on demand when the run folder is on another device than the dataset
+    boost::system::error_code error;
+    boost::filesystem::remove(target, error);
+    boost::filesystem::create_symlink(boost::filesystem::absolute(source), target, error);
+    if(!error)
+        return true;
+
+    boost::filesystem::create_hard_link(source, target, error);
+    if(!error)
+        return true;
+
+    if(!bAllowCopy)
+        throw CException(CoreExCode::INVALID_FILE, "Unable to link " + source + " into the run folder (" + error.message() + "), enable allowCopy to copy dataset files instead.", __func__, __FILE__, __LINE__);
+
+    boost::filesystem::copy_file(source, target, boost::filesystem::copy_option::overwrite_if_exists);
+    return false;
+}
+
+QString CYoloTrain::createRunFolder(const QString &parentFolder, const QString &name) const
+{
+    // Folder creation fails if it already exists: first free name is claimed atomically,
+    // even by trainings started at the same time in other processes
+    Utils::File::createDirectory(parentFolder.toStdString());
+    QDir parentDir(parentFolder);
+
+    for(int i=0; i<1000; ++i)
+    {
+        QString folderName = i == 0 ? name : QString("%1_%2").arg(name).arg(i);
+        if(parentDir.mkdir(folderName))
+            return parentDir.absoluteFilePath(folderName);
+    }
+    throw CException(CoreExCode::INVALID_FILE, "Unable to create run folder in " + parentFolder.toStdString(), __func__, __FILE__, __LINE__);
+}
+
+void CYoloTrain::deleteRunFolder()
+{
+    if(m_dataFolder.isEmpty())
+        return;
+
+    // Darknet log is kept with the models
+    boost::system::error_code error;
+    if(!m_outputFolder.isEmpty() && QFile::exists(m_dataFolder + "/log.txt"))
+        boost::filesystem::copy_file((m_dataFolder + "/log.txt").toStdString(), (m_outputFolder + "/log.txt").toStdString(), boost::filesystem::copy_option::overwrite_if_exists, error);
+
+    boost::filesystem::remove_all(m_dataFolder.toStdString(), error);
+    m_dataFolder.clear();
+}
+
+void CYoloTrain::splitTrainEval(const QJsonDocument &json, float ratio, size_t evalSubsetSize)
 {
-    std::string pluginDir = Utils::Plugin::getCppPath() + "/" + Utils::File::conformName(QString::fromStdString(m_name)).toStdString() + "/";
     QJsonObject root = json.object();
     auto itImages = root.find("images");
 
@@ -408,23 +624,29 @@ void CYoloTrain::splitTrainEval(const QJsonDocument &json, float ratio)
     if(itImages.value().isArray() == false)
         throw CException(CoreExCode::INVALID_JSON_FORMAT, "Invalid dataset structure.", __func__, __FILE__, __LINE__);
 
-    std::vector<std::string> imagePaths;
+    // Run folder links, same order as dataset images
+    const auto& imagePaths = m_imagePaths;
     auto images = itImages.value().toArray();
 
-    for(auto&& imgRef : images)
-    {
-        auto img = imgRef.toObject();
-        imagePaths.push_back(img["filename"].toString().toStdString());
-    }
-
     // Split dataset randomly
-    size_t trainSize = (size_t)(ratio * imagePaths.size());
-    std::random_shuffle(imagePaths.begin(), imagePaths.end());
-    auto trainImgPaths = std::vector<std::string>(imagePaths.begin(), imagePaths.begin() + trainSize);
-    auto evalImgPaths = std::vector<std::string>(imagePaths.begin() + trainSize, imagePaths.end());
+    std::vector<size_t> indices(imagePaths.size());
+    std::iota(indices.begin(), indices.end(), 0);
+    std::random_shuffle(indices.begin(), indices.end());
+    size_t trainSize = (size_t)(ratio * indices.size());
+    auto trainIndices = std::vector<size_t>(indices.begin(), indices.begin() + trainSize);
+    auto evalIndices = std::vector<size_t>(indices.begin() + trainSize, indices.end());
+    std::vector<std::string> trainImgPaths, evalImgPaths;
+
+    for(auto&& index : trainIndices)
+        trainImgPaths.push_back(imagePaths[index]);
+
+    for(auto&& index : evalIndices)
+        evalImgPaths.push_back(imagePaths[index]);
+
+    m_trainImageCount = trainImgPaths.size();
 
     // Save file train.txt containing image paths of training set
-    std::string trainPath = pluginDir + "data/train.txt";
+    std::string trainPath = m_dataFolder.toStdString() + "/train.txt";
     QFile trainFile(QString::fromStdString(trainPath));
 
     if(trainFile.open(QFile::WriteOnly | QFile::Text) == false)
@@ -437,7 +659,7 @@ void CYoloTrain::splitTrainEval(const QJsonDocument &json, float ratio)
     trainFile.close();
 
     // Save file eval.txt containing image paths of evaluation set
-    std::string evalPath = pluginDir + "data/eval.txt";
+    std::string evalPath = m_dataFolder.toStdString() + "/eval.txt";
     QFile evalFile(QString::fromStdString(evalPath));
 
     if(evalFile.open(QFile::WriteOnly | QFile::Text) == false)
@@ -448,18 +670,129 @@ void CYoloTrain::splitTrainEval(const QJsonDocument &json, float ratio)
         evalStream << QString::fromStdString(evalImgPaths[i]) << "\n";
 
     evalFile.close();
+
+    // Save file eval_subset.txt containing the fixed-size subset used for in-training mAP,
+    // eval.txt is kept complete for final scoring
+    std::string subsetPath = m_dataFolder.toStdString() + "/eval_subset.txt";
+    QFile::remove(QString::fromStdString(subsetPath));
+    m_validListPath = QString::fromStdString(evalPath);
+
+    if(evalSubsetSize == 0 || evalSubsetSize >= evalIndices.size())
+        return;
+
+    auto subsetIndices = sampleStratifiedSubset(images, evalIndices, evalSubsetSize);
+    emit m_signalHandler->doLog(QString("In-training evaluation subset: %1 images out of %2").arg(subsetIndices.size()).arg(evalIndices.size()));
+    QFile subsetFile(QString::fromStdString(subsetPath));
+
+    if(subsetFile.open(QFile::WriteOnly | QFile::Text) == false)
+        throw CException(CoreExCode::INVALID_FILE, "Unable to create file eval_subset.txt", __func__, __FILE__, __LINE__);
+
+    QTextStream subsetStream(&subsetFile);
+    for(auto&& index : subsetIndices)
+        subsetStream << QString::fromStdString(imagePaths[index]) << "\n";
+
+    subsetFile.close();
+    m_validListPath = QString::fromStdString(subsetPath);
 }
 
-void CYoloTrain::launchTraining()
+std::vector<size_t> CYoloTrain::sampleStratifiedSubset(const QJsonArray &images, const std::vector<size_t> &indices, size_t size) const
+{
+    // Class frequencies over the candidate images
+    std::map<int, size_t> classFrequencies;
+    std::vector<std::set<int>> imageClasses(indices.size());
+
+    for(size_t i=0; i<indices.size(); ++i)
+    {
+        auto annotations = images[(int)indices[i]].toObject()["annotations"].toArray();
+        for(auto&& annRef : annotations)
+            imageClasses[i].insert(annRef.toObject()["category_id"].toInt());
+
+        for(auto&& classId : imageClasses[i])
+            classFrequencies[classId]++;
+    }
+
+    // Each image belongs to the stratum of its rarest class so that rare classes stay represented,
+    // images without annotation form their own stratum (-1)
+    std::map<int, std::vector<size_t>> strata;
+    for(size_t i=0; i<indices.size(); ++i)
+    {
+        int stratum = -1;
+        for(auto&& classId : imageClasses[i])
+        {
+            if(stratum == -1 || classFrequencies[classId] < classFrequencies[stratum])
+                stratum = classId;
+        }
+        strata[stratum].push_back(indices[i]);
+    }
+
+    // Proportional allocation with at least one image per stratum, as long as the size allows it
+    std::vector<std::pair<int, size_t>> quotas;
+    size_t total = 0;
+
+    for(auto&& stratum : strata)
+    {
+        size_t quota = std::max((size_t)1, (size_t)std::round((double)size * stratum.second.size() / indices.size()));
+        quota = std::min(quota, stratum.second.size());
+        quotas.push_back(std::make_pair(stratum.first, quota));
+        total += quota;
+    }
+
+    // Fix rounding: adjust the largest strata first
+    std::sort(quotas.begin(), quotas.end(), [&strata](const std::pair<int, size_t>& q1, const std::pair<int, size_t>& q2)
+    {
+        return strata[q1.first].size() > strata[q2.first].size();
+    });
+
+    for(size_t i=0; total != size && i < quotas.size() * size; ++i)
+    {
+        auto& quota = quotas[i % quotas.size()];
+        if(total > size && quota.second > 1)
+        {
+            quota.second--;
+            total--;
+        }
+        else if(total < size && quota.second < strata[quota.first].size())
+        {
+            quota.second++;
+            total++;
+        }
+    }
+
+    // More strata than requested images: rarest strata are kept first, images without annotation last,
+    // until the size is reached
+    if(total > size)
+    {
+        std::sort(quotas.begin(), quotas.end(), [&strata](const std::pair<int, size_t>& q1, const std::pair<int, size_t>& q2)
+        {
+            if((q1.first == -1) != (q2.first == -1))
+                return q2.first == -1;
+
+            return strata[q1.first].size() < strata[q2.first].size();
+        });
+
+        size_t remaining = size;
+        for(auto&& quota : quotas)
+        {
+            quota.second = std::min(quota.second, remaining);
+            remaining -= quota.second;
+        }
+    }
+
+    // Candidate indices are already shuffled, keep the first ones of each stratum
+    std::vector<size_t> subset;
+    for(auto&& quota : quotas)
+    {
+        auto& stratumIndices = strata[quota.first];
+        subset.insert(subset.end(), stratumIndices.begin(), stratumIndices.begin() + quota.second);
+    }
+    return subset;
+}
+
+QString CYoloTrain::getPretrainedWeights()
 {
     auto paramPtr = std::dynamic_pointer_cast<CYoloTrainParam>(m_pParam);
     QString pluginDir = QString::fromStdString(Utils::Plugin::getCppPath()) + "/" + Utils::File::conformName(QString::fromStdString(m_name)) + "/";
-    QString dataFilePath = pluginDir + "data/training.data";
-    QString configFilePath = QString::fromStdString(paramPtr->m_cfg["configPath"]);
     QString weightsFilePath = pluginDir + "data/models/pretrained/" + _modelWeightFiles[QString::fromStdString(paramPtr->m_cfg["model"])];
-    QString metricsFilePath = pluginDir + "data/metrics.txt";
-    QString logFilePath = pluginDir + "data/log.txt";
-    QString darknetExe = pluginDir + "darknet";
 
     std::string weightPath = weightsFilePath.toStdString();
     if (!Utils::File::isFileExist(weightPath))
@@ -469,7 +802,104 @@ void CYoloTrain::launchTraining()
         std::string downloadUrl = Utils::Plugin::getModelHubUrl() + "/" + m_name + "/" + modelName;
         download(downloadUrl, weightPath);
     }
+    return weightsFilePath;
+}
+
+bool CYoloTrain::launchTraining(const QString &configFilePath, const QString &weightsFilePath)
+{
+    auto paramPtr = std::dynamic_pointer_cast<CYoloTrainParam>(m_pParam);
+    QString dataFilePath = m_dataFolder + "/training.data";
+    CDarknetConfig config(configFilePath.toStdString());
+    int maxIteration = config.getNet().getInt("max_batches", 0);
+
+    std::string engine = paramPtr->m_cfg["engine"];
+    if(engine != "process" && engine != "library")
+        throw CException(CoreExCode::INVALID_PARAMETER, "Invalid training engine, available engines are: process,library", __func__, __FILE__, __LINE__);
 
+    //MLflow is quiet slow, we log metrics asynchronously
+    m_bFinished = false;
+    m_bDarknetFinished = false;
+    m_mlflowLogFreq = std::max(1, maxIteration / 100);
+    auto mlflowFuture = Utils::async([&]
+    {
+        while(true)
+        {
+            YoloMetrics metrics;
+            {
+                std::unique_lock<std::mutex> lock(m_metricsMutex);
+                m_metricsCondition.wait(lock, [this]{ return !m_metricsQueue.empty() || m_bFinished; });
+
+                if(m_metricsQueue.empty())
+                    break;
+
+                metrics = m_metricsQueue.front();
+                m_metricsQueue.pop();
+            }
+            int epoch = (int)metrics["Epoch"];
+            metrics.erase("Epoch");
+            logMetrics(metrics, m_stepOffset + epoch - 1);
+        }
+    });
+
+    //Checkpoints are evaluated asynchronously as soon as darknet saves them
+    bool bNativeEval = std::stoi(paramPtr->m_cfg["nativeEval"]);
+    std::future<void> evalFuture;
+    if(bNativeEval)
+        evalFuture = Utils::async([&]{ evaluateCheckpoints(configFilePath.toStdString()); });
+
+    //Asynchronous tasks must be terminated before any error is reported
+    std::exception_ptr trainingError = nullptr;
+    try
+    {
+        if(engine == "library")
+            runDarknetLibrary(dataFilePath, configFilePath, weightsFilePath);
+        else
+            runDarknetProcess(dataFilePath, configFilePath, weightsFilePath);
+    }
+    catch(...)
+    {
+        trainingError = std::current_exception();
+    }
+
+    bool bStopped = m_bStop;
+    m_bDarknetFinished = true;
+
+    if(bNativeEval)
+    {
+        emit m_signalHandler->doLog("Waiting for checkpoints evaluation...");
+        evalFuture.wait();
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_metricsMutex);
+        m_bFinished = true;
+    }
+    m_metricsCondition.notify_all();
+
+    if(trainingError)
+        std::rethrow_exception(trainingError);
+
+    //Wait for MLflow logging process - timeout: 2 min
+    emit m_signalHandler->doLog("Waiting for MLflow logging process...");
+    mlflowFuture.wait_for(std::chrono::minutes(2));
+
+    //Log config file
+    logArtifact(configFilePath.toStdString());
+
+    //Copy files needed for inference
+    auto outFolder = m_outputFolder.toStdString();
+    auto configFileName = boost::filesystem::path(configFilePath.toStdString()).filename().string();
+    boost::filesystem::copy_file(configFilePath.toStdString(), outFolder + "/" + configFileName, boost::filesystem::copy_option::overwrite_if_exists);
+    boost::filesystem::copy_file(m_dataFolder.toStdString() + "/classes.txt", outFolder + "/classes.txt", boost::filesystem::copy_option::overwrite_if_exists);
+    return !bStopped;
+}
+
+void CYoloTrain::runDarknetProcess(const QString &dataFilePath, const QString &configFilePath, const QString &weightsFilePath)
+{
+    auto paramPtr = std::dynamic_pointer_cast<CYoloTrainParam>(m_pParam);
+    QString pluginDir = QString::fromStdString(Utils::Plugin::getCppPath()) + "/" + Utils::File::conformName(QString::fromStdString(m_name)) + "/";
+    QString metricsFilePath = m_dataFolder + "/metrics.txt";
+    QString logFilePath = m_dataFolder + "/log.txt";
+    QString darknetExe = pluginDir + "darknet";
     QProcessEnvironment env = QProcessEnvironment::systemEnvironment();
 
     auto libFolder = QString::fromStdString(Utils::IkomiaApp::getIkomiaLibFolder());
@@ -489,7 +919,14 @@ void CYoloTrain::launchTraining()
     }
 
     QStringList args;
-    args << "detector" << "train" << dataFilePath << configFilePath << weightsFilePath << "-dont_show" << "-map" << "-log_metrics";
+    args << "detector" << "train" << dataFilePath << configFilePath << weightsFilePath << "-dont_show" << "-log_metrics";
+
+    // Native evaluation runs outside darknet so that training keeps its device to itself
+    if(!std::stoi(paramPtr->m_cfg["nativeEval"]))
+        args << "-map" << "-mAP_epochs" << QString::fromStdString(paramPtr->m_cfg["evalPeriod"]);
+
+    // Metrics of a previous training of the run (pruning fine-tune) must not be read again
+    QFile::remove(metricsFilePath);
 
     QProcess proc;
     proc.setProcessEnvironment(env);
@@ -503,58 +940,435 @@ void CYoloTrain::launchTraining()
     metricsFile.open(QFile::ReadOnly | QFile::Text);
     QTextStream metricsStream(&metricsFile);
 
-    //MLflow is quiet slow, we log metrics asynchronously
-    m_mlflowLogFreq = std::max(1, std::stoi(paramPtr->m_cfg["epochs"]) / 100);
-    auto mlflowFuture = Utils::async([&]
+    while(!proc.waitForFinished(1) && m_bStop == false)
+        loadMetrics(metricsStream);
+
+    if(m_bStop)
+        proc.kill();
+    else
     {
-        while(!m_metricsQueue.empty() || m_bFinished == false)
+        auto status = proc.exitStatus();
+        if(status == QProcess::CrashExit)
+            throw CException(CoreExCode::UNKNOWN, "Darknet internal error.");
+    }
+}
+
+void CYoloTrain::runDarknetLibrary(const QString &dataFilePath, const QString &configFilePath, const QString &weightsFilePath)
+{
+#ifdef TRAINYOLO_WITH_LIBDARKNET
+    auto paramPtr = std::dynamic_pointer_cast<CYoloTrainParam>(m_pParam);
+
+    CDarknetEngine engine(dataFilePath.toStdString(), (m_dataFolder + "/train.txt").toStdString(), configFilePath.toStdString(), weightsFilePath.toStdString());
+    engine.setBackupFolder(m_outputFolder.toStdString());
+
+    if(!std::stoi(paramPtr->m_cfg["nativeEval"]))
+        engine.setMapPeriod(std::stoi(paramPtr->m_cfg["evalPeriod"]));
+
+    // Metrics go straight to the metrics queue, no file polling
+    engine.setIterationCallback([this](int iteration, float loss, float map, float bestMap)
+    {
+        handleMetrics(iteration, loss, map, bestMap);
+    });
+    engine.train(m_bStop);
+#else
+    Q_UNUSED(dataFilePath);
+    Q_UNUSED(configFilePath);
+    Q_UNUSED(weightsFilePath);
+    throw CException(CoreExCode::NOT_IMPLEMENTED, "Darknet library engine is not available: plugin built without TRAINYOLO_WITH_LIBDARKNET.", __func__, __FILE__, __LINE__);
+#endif
+}
+
+void CYoloTrain::evaluateCheckpoints(const std::string& configPath)
+{
+    auto paramPtr = std::dynamic_pointer_cast<CYoloTrainParam>(m_pParam);
+    std::string prefix = boost::filesystem::path(configPath).stem().string();
+    CDarknetConfig config(configPath);
+    int maxIteration = config.getNet().getInt("max_batches", 0);
+    int netBatch = config.getNet().getInt("batch", 1);
+    QRegularExpression re(QString("^%1_([0-9]+|final)\\.weights$").arg(QRegularExpression::escape(QString::fromStdString(prefix))));
+    std::map<QString, qint64> pendingSizes;
+    std::set<QString> evaluated;
+    float bestMap = -1.0f;
+    // State of the last weights file at previous poll and at last snapshot
+    QString lastPath = m_outputFolder + "/" + QString::fromStdString(prefix) + "_last.weights";
+    std::pair<QDateTime, qint64> lastState;
+    QDateTime snapshotTime;
+    // Temporary copy of the last weights, not matched by checkpoint patterns
+    QString snapshotPath = m_outputFolder + "/" + QString::fromStdString(prefix) + "_snapshot.tmp";
+
+    // Same cadence as darknet -mAP_epochs
+    int batchSize = std::max(1, std::stoi(paramPtr->m_cfg["batchSize"]));
+    int evalPeriod = std::stoi(paramPtr->m_cfg["evalPeriod"]) * (int)m_trainImageCount / batchSize;
+    int lastIteration = 0;
+
+    try
+    {
+        // In-training evaluation uses the same image list as darknet valid entry
+        CYoloEvaluator evaluator(m_validListPath.toStdString(), m_classCount);
+        evaluator.setWorkerCount(std::stoi(paramPtr->m_cfg["evalWorkers"]));
+
+        while(m_bStop == false)
         {
-            if(!m_metricsQueue.empty())
+            // Once training is over, every checkpoint on disk is complete
+            bool bTrainingDone = m_bDarknetFinished;
+            std::vector<std::pair<int, QString>> checkpoints;
+            QDir outputDir(m_outputFolder);
+            auto files = outputDir.entryInfoList(QStringList() << "*.weights", QDir::Files);
+
+            for(auto&& fileInfo : files)
             {
-                auto metrics = m_metricsQueue.front();
-                m_metricsQueue.pop();
-                int epoch = (int)metrics["Epoch"];
-                metrics.erase("Epoch");
-                logMetrics(metrics, epoch - 1);
+                auto match = re.match(fileInfo.fileName());
+                if(!match.hasMatch() || evaluated.find(fileInfo.fileName()) != evaluated.end())
+                    continue;
+
+                // Darknet may still be writing the file: wait for its size to be stable between two polls
+                auto itSize = pendingSizes.find(fileInfo.fileName());
+                if(bTrainingDone || (itSize != pendingSizes.end() && itSize->second == fileInfo.size() && fileInfo.size() > 0))
+                {
+                    int iteration = match.captured(1) == "final" ? maxIteration : match.captured(1).toInt();
+                    checkpoints.push_back(std::make_pair(iteration, fileInfo.fileName()));
+                }
+                else
+                    pendingSizes[fileInfo.fileName()] = fileInfo.size();
+            }
+
+            // Darknet saves numbered checkpoints every 1000 iterations only, but rewrites the last weights every 100 iterations:
+            // when an evaluation is due, the last weights are copied once stable and the copy is removed once scored
+            QFileInfo lastInfo(lastPath);
+            if(!bTrainingDone && lastInfo.exists())
+            {
+                auto state = std::make_pair(lastInfo.lastModified(), lastInfo.size());
+                if(state == lastState && state.first != snapshotTime)
+                {
+                    int iteration = getCheckpointIteration(lastPath, netBatch);
+                    if(iteration < lastIteration + evalPeriod || iteration >= maxIteration)
+                        snapshotTime = state.first;
+                    else
+                    {
+                        QFile::remove(snapshotPath);
+
+                        // Discard the copy if darknet rewrote the file meanwhile
+                        if(QFile::copy(lastPath, snapshotPath) && QFileInfo(lastPath).lastModified() == state.first)
+                        {
+                            checkpoints.push_back(std::make_pair(getCheckpointIteration(snapshotPath, netBatch), QFileInfo(snapshotPath).fileName()));
+                            snapshotTime = state.first;
+                        }
+                        else
+                            QFile::remove(snapshotPath);
+                    }
+                }
+                lastState = state;
+            }
+
+            std::sort(checkpoints.begin(), checkpoints.end());
+            for(auto&& checkpoint : checkpoints)
+            {
+                if(m_bStop)
+                    break;
+
+                if(checkpoint.first < maxIteration && checkpoint.first - lastIteration < evalPeriod)
+                {
+                    evaluated.insert(checkpoint.second);
+                    continue;
+                }
+
+                lastIteration = checkpoint.first;
+                auto weightsPath = m_outputFolder + "/" + checkpoint.second;
+                auto result = evaluator.evaluate(configPath, weightsPath.toStdString(), m_bStop);
+                evaluated.insert(checkpoint.second);
+
+                if(m_bStop)
+                    break;
+
+                // Keep darknet naming for the best checkpoint
+                if(result.m_mAP50 > bestMap)
+                {
+                    bestMap = result.m_mAP50;
+                    boost::filesystem::copy_file(weightsPath.toStdString(), m_outputFolder.toStdString() + "/" + prefix + "_best.weights",
+                                                 boost::filesystem::copy_option::overwrite_if_exists);
+                }
+
+                YoloMetrics metrics;
+                metrics["Epoch"] = checkpoint.first;
+                metrics["mAP"] = result.m_mAP50;
+                metrics["mAP50-95"] = result.m_mAP;
+                metrics["Best mAP"] = bestMap;
+
+                for(size_t i=0; i<result.m_classAP50.size() && i<m_classNames.size(); ++i)
+                {
+                    if(result.m_classAP50[i] >= 0)
+                        metrics[toMetricName("AP_" + m_classNames[i])] = result.m_classAP50[i];
+                }
+                pushMetrics(metrics);
+
+                auto logMsg = QString("Checkpoint #%1 - mAP@0.5 = %2 - mAP@0.5:0.95 = %3 - Best mAP = %4")
+                        .arg(checkpoint.first)
+                        .arg(result.m_mAP50)
+                        .arg(result.m_mAP)
+                        .arg(bestMap);
+                emit m_signalHandler->doLog(logMsg);
             }
+            // Best snapshot has already been copied as best weights
+            QFile::remove(snapshotPath);
+
+            if(bTrainingDone)
+                break;
+
+            std::this_thread::sleep_for(std::chrono::seconds(1));
         }
-    });
+    }
+    catch(std::exception& e)
+    {
+        emit m_signalHandler->doLog(QString("Checkpoint evaluation failed: %1").arg(e.what()));
+    }
+    QFile::remove(snapshotPath);
+}
 
-    while(!proc.waitForFinished(1) && m_bStop == false)
-        loadMetrics(metricsStream);
+void CYoloTrain::selectBestCheckpoint(const std::string& configPath)
+{
+    auto paramPtr = std::dynamic_pointer_cast<CYoloTrainParam>(m_pParam);
+    std::string prefix = boost::filesystem::path(configPath).stem().string();
+    std::string metricName = paramPtr->m_cfg["selectionMetric"];
+    double latencyBudget = std::stod(paramPtr->m_cfg["latencyBudget"]);
+    int workerCount = std::max(1, std::stoi(paramPtr->m_cfg["selectionWorkers"]));
+
+    if(metricName != "mAP50" && metricName != "mAP50-95")
+        throw CException(CoreExCode::INVALID_PARAMETER, "Invalid selection metric, available metrics are: mAP50,mAP50-95", __func__, __FILE__, __LINE__);
+
+    QDir outputDir(m_outputFolder);
+    auto files = outputDir.entryList(QStringList() << QString::fromStdString(prefix + "_*.weights"), QDir::Files, QDir::Name);
+    if(files.size() < 2)
+        return;
+
+    emit m_signalHandler->doLog(QString("Selecting best checkpoint among %1 weights files...").arg(files.size()));
+
+    // Each worker evaluates one checkpoint at a time with a single network instance,
+    // so the number of models in memory is bounded by the worker count
+    CYoloEvaluator evaluator((m_dataFolder + "/eval.txt").toStdString(), m_classCount);
+    evaluator.setWorkerCount(1);
+
+    std::vector<CYoloEvalResult> results(files.size());
+    std::vector<char> bValid(files.size(), false);
+    std::atomic<int> nextFile{0};
+    std::vector<std::thread> workers;
+
+    for(int i=0; i<std::min(workerCount, files.size()); ++i)
+    {
+        workers.push_back(std::thread([&]
+        {
+            int index;
+            while(m_bStop == false && (index = nextFile++) < files.size())
+            {
+                try
+                {
+                    auto weightsPath = m_outputFolder + "/" + files[index];
+                    results[index] = evaluator.evaluate(configPath, weightsPath.toStdString(), m_bStop);
+                    bValid[index] = (m_bStop == false);
+                }
+                catch(std::exception& e)
+                {
+                    emit m_signalHandler->doLog(QString("Evaluation of %1 failed: %2").arg(files[index]).arg(e.what()));
+                }
+            }
+        }));
+    }
+
+    for(auto&& worker : workers)
+        worker.join();
 
     if(m_bStop)
+        return;
+
+    int bestIndex = -1;
+    auto metric = [&](int i){ return metricName == "mAP50" ? results[i].m_mAP50 : results[i].m_mAP; };
+
+    for(int i=0; i<files.size(); ++i)
     {
-        proc.kill();
-        m_bStop = false;
+        if(!bValid[i])
+            continue;
+
+        emit m_signalHandler->doLog(QString("%1: mAP@0.5 = %2 - mAP@0.5:0.95 = %3")
+                                    .arg(files[i])
+                                    .arg(results[i].m_mAP50)
+                                    .arg(results[i].m_mAP));
+
+        if(bestIndex < 0 || metric(i) > metric(bestIndex))
+            bestIndex = i;
     }
-    else
+
+    if(bestIndex < 0)
+        throw CException(CoreExCode::INVALID_FILE, "No valid checkpoint found.", __func__, __FILE__, __LINE__);
+
+    // All checkpoints share the same config, thus the same architecture and latency:
+    // it is measured once, without concurrent workers competing for CPU threads
+    double latency = evaluator.measureLatency(configPath, (m_outputFolder + "/" + files[bestIndex]).toStdString(), 20);
+    emit m_signalHandler->doLog(QString("Model latency: %1 ms").arg(latency));
+
+    if(latencyBudget > 0 && latency > latencyBudget)
+        emit m_signalHandler->doLog(QString("Warning: model latency exceeds the budget (%1 ms), checkpoints can't meet it. The best one is kept.").arg(latencyBudget));
+
+    // Keep the winner as <name>_best.weights next to training.cfg and classes.txt, delete the others
+    auto bestName = QString::fromStdString(prefix + "_best.weights");
+    if(files[bestIndex] != bestName)
     {
-        auto status = proc.exitStatus();
-        if(status == QProcess::CrashExit)
-            throw CException(CoreExCode::UNKNOWN, "Darknet internal error.");
+        outputDir.remove(bestName);
+        outputDir.rename(files[bestIndex], bestName);
     }
-    m_bFinished = true;
 
-    //Wait for MLflow logging process - timeout: 2 min
-    emit m_signalHandler->doLog("Waiting for MLflow logging process...");
-    mlflowFuture.wait_for(std::chrono::minutes(2));
+    // Checkpoints whose evaluation failed are kept: they have never been scored
+    for(int i=0; i<files.size(); ++i)
+    {
+        if(bValid[i] && i != bestIndex && files[i] != bestName)
+            outputDir.remove(files[i]);
+    }
 
-    //Log config file
-    logArtifact(configFilePath.toStdString());
+    YoloMetrics metrics;
+    metrics["Selected mAP"] = results[bestIndex].m_mAP50;
+    metrics["Selected mAP50-95"] = results[bestIndex].m_mAP;
+    metrics["Selected latency"] = (float)latency;
+    logMetrics(metrics, m_stepOffset + CDarknetConfig(configPath).getNet().getInt("max_batches", 0));
 
-    //Copy files needed for inference
-    auto outFolder = m_outputFolder.toStdString();
-    auto pluginFolder = pluginDir.toStdString();
-    boost::filesystem::copy_file(pluginFolder + "data/config/training.cfg", outFolder + "/training.cfg", boost::filesystem::copy_option::overwrite_if_exists);
-    boost::filesystem::copy_file(pluginFolder + "data/classes.txt", outFolder + "/classes.txt", boost::filesystem::copy_option::overwrite_if_exists);
+    emit m_signalHandler->doLog(QString("Best checkpoint: %1 (saved as %2)").arg(files[bestIndex]).arg(bestName));
+}
 
-    emit m_signalHandler->doLog("YOLO training finished!");
+void CYoloTrain::pruneModel(const std::string &configPath)
+{
+    auto paramPtr = std::dynamic_pointer_cast<CYoloTrainParam>(m_pParam);
+    std::string prefix = boost::filesystem::path(configPath).stem().string();
+    double targetReduction = std::stod(paramPtr->m_cfg["pruneRatio"]);
+    int finetuneIterations = std::stoi(paramPtr->m_cfg["pruneFinetuneIterations"]);
+
+    // Prune the best available checkpoint
+    std::string weightsPath = findCheckpoint(prefix);
+    if(weightsPath.empty())
+    {
+        emit m_signalHandler->doLog("Pruning skipped: no checkpoint found.");
+        return;
+    }
+
+    emit m_signalHandler->doLog(QString("Pruning %1...").arg(QString::fromStdString(weightsPath)));
+    CDarknetModel model(configPath, weightsPath);
+    CYoloPruner pruner(model);
+    double reduction = pruner.prune(targetReduction);
+
+    // Pruned weights are a new starting point: darknet must not resume the previous schedule
+    model.setSeen(0);
+    std::string prunedConfigPath = m_outputFolder.toStdString() + "/pruned.cfg";
+    std::string prunedWeightsPath = m_outputFolder.toStdString() + "/pruned.weights";
+    model.save(prunedConfigPath, prunedWeightsPath);
+
+    // Accuracy before fine-tune
+    CYoloEvaluator evaluator((m_dataFolder + "/eval.txt").toStdString(), m_classCount);
+    evaluator.setWorkerCount(std::stoi(paramPtr->m_cfg["evalWorkers"]));
+    auto result = evaluator.evaluate(prunedConfigPath, prunedWeightsPath, m_bStop);
+
+    int maxIteration = CDarknetConfig(configPath).getNet().getInt("max_batches", 0);
+    YoloMetrics metrics;
+    metrics["Pruned FLOPs reduction"] = (float)reduction;
+    metrics["Pruned mAP"] = result.m_mAP50;
+    metrics["Pruned mAP50-95"] = result.m_mAP;
+    logMetrics(metrics, m_stepOffset + maxIteration);
+
+    emit m_signalHandler->doLog(QString("Pruned model: FLOPs reduction = %1% - mAP@0.5 = %2 - mAP@0.5:0.95 = %3")
+                                .arg(reduction * 100.0, 0, 'f', 1)
+                                .arg(result.m_mAP50)
+                                .arg(result.m_mAP));
+
+    if(finetuneIterations <= 0 || m_bStop)
+        return;
+
+    // Short fine-tune with the same hyper-parameters, schedule scaled to the iterations count
+    auto& net = model.getConfig().getNet();
+    const double ratio = (double)finetuneIterations / std::max(1, maxIteration);
+    net.set("max_batches", std::to_string(finetuneIterations));
+
+    for(auto&& key : {"burn_in", "sgdr_cycle"})
+    {
+        if(net.has(key))
+            net.set(key, std::to_string((int)(net.getInt(key, 0) * ratio)));
+    }
+
+    if(net.has("steps"))
+    {
+        std::string steps;
+        for(auto&& step : net.getInts("steps"))
+            steps += (steps.empty() ? "" : ",") + std::to_string((int)(step * ratio));
+
+        net.set("steps", steps);
+    }
+
+    // Checkpoints are named from the config file: pruned_xxx.weights
+    auto finetuneConfigPath = m_dataFolder.toStdString() + "/pruned.cfg";
+    model.getConfig().save(finetuneConfigPath);
+
+    emit m_signalHandler->doLog(QString("Fine-tuning pruned model for %1 iterations...").arg(finetuneIterations));
+    emit m_signalHandler->doAddSubTotalSteps(finetuneIterations);
+    m_stepOffset += maxIteration;
+
+    if(launchTraining(QString::fromStdString(finetuneConfigPath), QString::fromStdString(prunedWeightsPath)) && std::stoi(paramPtr->m_cfg["selectBest"]))
+        selectBestCheckpoint(finetuneConfigPath);
 }
 
-void CYoloTrain::loadMetrics(QTextStream& stream)
+void CYoloTrain::exportOnnxModel(const std::string &configPath)
 {
+    auto paramPtr = std::dynamic_pointer_cast<CYoloTrainParam>(m_pParam);
+    std::string outFolder = m_outputFolder.toStdString();
+    int checkImages = std::stoi(paramPtr->m_cfg["onnxCheckImages"]);
+
+    // Final model: fine-tuned pruned model, pruned model or trained model
+    std::vector<std::pair<std::string, std::string>> models =
+    {
+        {outFolder + "/pruned.cfg", findCheckpoint("pruned")},
+        {outFolder + "/pruned.cfg", outFolder + "/pruned.weights"},
+        {outFolder + "/" + boost::filesystem::path(configPath).filename().string(), findCheckpoint(boost::filesystem::path(configPath).stem().string())}
+    };
+
+    auto it = std::find_if(models.begin(), models.end(), [](const std::pair<std::string, std::string>& model)
+    {
+        return !model.second.empty() && Utils::File::isFileExist(model.first) && Utils::File::isFileExist(model.second);
+    });
+
+    if(it == models.end())
+    {
+        emit m_signalHandler->doLog("ONNX export skipped: no checkpoint found.");
+        return;
+    }
+
+    auto onnxPath = outFolder + "/" + boost::filesystem::path(it->second).stem().string() + ".onnx";
+    emit m_signalHandler->doLog(QString("Exporting %1 to ONNX...").arg(QString::fromStdString(it->second)));
+
+    CYoloOnnxExporter exporter(it->first, it->second);
+    exporter.exportModel(onnxPath);
+
+    if(checkImages <= 0)
+        return;
+
+    // Same network run by OpenCV DNN from darknet files and from ONNX file
+    float maxDiff = exporter.checkEquivalence(onnxPath, (m_dataFolder + "/eval.txt").toStdString(), checkImages);
     YoloMetrics metrics;
+    metrics["ONNX max abs difference"] = maxDiff;
+    logMetrics(metrics, m_stepOffset + CDarknetConfig(it->first).getNet().getInt("max_batches", 0));
+
+    auto logMsg = QString("ONNX model saved to %1 - max abs difference with darknet = %2").arg(QString::fromStdString(onnxPath)).arg(maxDiff);
+    if(maxDiff > 1e-3f)
+        logMsg += " - WARNING: outputs differ, check ONNX model before deployment";
+
+    emit m_signalHandler->doLog(logMsg);
+}
+
+std::string CYoloTrain::findCheckpoint(const std::string &prefix) const
+{
+    for(auto&& suffix : {"_best", "_final", "_last"})
+    {
+        auto path = m_outputFolder.toStdString() + "/" + prefix + suffix + ".weights";
+        if(Utils::File::isFileExist(path))
+            return path;
+    }
+    return "";
+}
+
+void CYoloTrain::loadMetrics(QTextStream& stream)
+{
     std::vector<std::string> values;
 
     if(stream.atEnd())
@@ -565,29 +1379,76 @@ void CYoloTrain::loadMetrics(QTextStream& stream)
     if(values.size() != 4)
         return;
 
-    int iteration = std::stoi(values[0]);
+    handleMetrics(std::stoi(values[0]), std::stof(values[1]), std::stof(values[2]), std::stof(values[3]));
+}
+
+void CYoloTrain::handleMetrics(int iteration, float loss, float map, float bestMap)
+{
+    YoloMetrics metrics;
     metrics["Epoch"] = iteration;
-    metrics["Loss"] = std::stof(values[1]);
-    metrics["mAP"] = std::stof(values[2]);
-    metrics["Best mAP"] = std::stof(values[3]);
+    metrics["Loss"] = loss;
+    auto logMsg = QString("Epoch #%1 - Loss = %2").arg(iteration).arg(loss);
 
-    auto logMsg = QString("Epoch #%1 - Loss = %2 - mAP = %3 - Best mAP = %4")
-            .arg(QString::fromStdString(values[0]))
-            .arg(QString::fromStdString(values[1]))
-            .arg(QString::fromStdString(values[2]))
-            .arg(QString::fromStdString(values[3]));
+    // mAP values are only computed by darknet when native evaluation is disabled
+    auto paramPtr = std::dynamic_pointer_cast<CYoloTrainParam>(m_pParam);
+    if(!std::stoi(paramPtr->m_cfg["nativeEval"]) && map >= 0)
+    {
+        metrics["mAP"] = map;
+        metrics["Best mAP"] = bestMap;
+        logMsg += QString(" - mAP = %1 - Best mAP = %2").arg(map).arg(bestMap);
+    }
 
     emit m_signalHandler->doLog(logMsg);
     emit m_signalHandler->doProgress();
 
-    if(iteration % m_mlflowLogFreq == 1)
-        m_metricsQueue.push(metrics);
+    // First iteration then every m_mlflowLogFreq, also valid for short trainings (frequency 1)
+    if((iteration - 1) % m_mlflowLogFreq == 0)
+        pushMetrics(metrics);
+}
+
+std::string CYoloTrain::toMetricName(const std::string &name)
+{
+    // MLflow metric names: alphanumerics, underscores, dashes, periods, spaces, colons and slashes only
+    std::string metricName = name;
+    for(auto&& c : metricName)
+    {
+        if(!std::isalnum((unsigned char)c) && std::string("_-. :/").find(c) == std::string::npos)
+            c = '_';
+    }
+    return metricName;
+}
+
+int CYoloTrain::getCheckpointIteration(const QString &weightsPath, int batch) const
+{
+    // Darknet weights header: major, minor, revision, then images seen count (64 bits since version 0.2)
+    std::ifstream file(weightsPath.toStdString(), std::ios::binary);
+    int32_t major = 0, minor = 0, revision = 0;
+    uint64_t seen = 0;
+    file.read(reinterpret_cast<char*>(&major), sizeof(int32_t));
+    file.read(reinterpret_cast<char*>(&minor), sizeof(int32_t));
+    file.read(reinterpret_cast<char*>(&revision), sizeof(int32_t));
+
+    if(major * 10 + minor >= 2)
+        file.read(reinterpret_cast<char*>(&seen), sizeof(uint64_t));
+    else
+    {
+        uint32_t seen32 = 0;
+        file.read(reinterpret_cast<char*>(&seen32), sizeof(uint32_t));
+        seen = seen32;
+    }
+
+    if(!file)
+        return -1;
+
+    return (int)(seen / std::max(1, batch));
 }
 
-void CYoloTrain::deleteTrainingFiles()
+void CYoloTrain::pushMetrics(const YoloMetrics &metrics)
 {
-    QString dataDir = QString::fromStdString(Utils::Plugin::getCppPath()) + "/" + Utils::File::conformName(QString::fromStdString(m_name)) + "/data/";
-    QFile::remove(dataDir + "log.txt");
-    QFile::remove(dataDir + "metrics.txt");
+    {
+        std::lock_guard<std::mutex> lock(m_metricsMutex);
+        m_metricsQueue.push(metrics);
+    }
+    m_metricsCondition.notify_one();
 }
 
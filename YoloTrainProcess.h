@@ -3,6 +3,9 @@
 
 #include <QTextStream>
 #include <QFile>
+#include <QJsonArray>
+#include <mutex>
+#include <condition_variable>
 #include "YoloTrainGlobal.hpp"
 #include "Task/CTaskFactory.hpp"
 #include "Task/CMlflowTrainTask.h"
@@ -38,30 +41,73 @@ class YOLOTRAIN_EXPORT CYoloTrain: public CMlflowTrainTask
 
         void        prepareData();
 
-        void        createAnnotationFiles(const QJsonDocument& json) const;
+        void        createAnnotationFiles(const QJsonDocument& json, bool bLinkLabels);
         void        createClassNamesFile(const QJsonDocument& json);
         void        createGlobalDataFile();
         void        createConfigFile();
 
+        QString     createSchedule(int iterations, int& burnin) const;
+
         void        updateParamFromConfigFile();
 
-        void        splitTrainEval(const QJsonDocument& json, float ratio = 0.9);
+        // Return false if the file had to be copied
+        bool        linkFile(const std::string& source, const std::string& target, bool bAllowCopy) const;
+
+        QString     createRunFolder(const QString& parentFolder, const QString& name) const;
+
+        void        deleteRunFolder();
+
+        void        splitTrainEval(const QJsonDocument& json, float ratio = 0.9, size_t evalSubsetSize = 0);
+
+        std::vector<size_t> sampleStratifiedSubset(const QJsonArray& images, const std::vector<size_t>& indices, size_t size) const;
+
+        QString     getPretrainedWeights();
 
-        void        launchTraining();
+        bool        launchTraining(const QString& configFilePath, const QString& weightsFilePath);
+        void        runDarknetProcess(const QString& dataFilePath, const QString& configFilePath, const QString& weightsFilePath);
+        void        runDarknetLibrary(const QString& dataFilePath, const QString& configFilePath, const QString& weightsFilePath);
+
+        void        evaluateCheckpoints(const std::string& configPath);
+
+        void        selectBestCheckpoint(const std::string& configPath);
+
+        void        pruneModel(const std::string& configPath);
+
+        void        exportOnnxModel(const std::string& configPath);
+
+        // Best available weights of a training: <prefix>_best, _final then _last (empty if none)
+        std::string findCheckpoint(const std::string& prefix) const;
 
         void        loadMetrics(QTextStream &stream);
+        void        handleMetrics(int iteration, float loss, float map, float bestMap);
+        // Replace characters rejected by MLflow in metric names
+        static std::string  toMetricName(const std::string& name);
+
+        // Training iteration stored in darknet weights header
+        int         getCheckpointIteration(const QString& weightsPath, int batch) const;
 
-        void        deleteTrainingFiles();
+        void        pushMetrics(const YoloMetrics& metrics);
 
     private:
 
         int                         m_classCount = 0;
         int                         m_mlflowLogFreq = 1;
+        // MLflow step of iteration 0, successive trainings (fine-tune) are logged one after the other
+        int                         m_stepOffset = 0;
+        size_t                      m_trainImageCount = 0;
         std::atomic_bool            m_bStop{false};
         std::atomic_bool            m_bFinished{false};
+        std::atomic_bool            m_bDarknetFinished{false};
         QString                     m_outputFolder;
+        QString                     m_validListPath;
+        // Run-local folder of image links and label files given to darknet
+        QString                     m_dataFolder;
+        std::vector<std::string>    m_imagePaths;
         QFile                       m_logFile;
         std::queue<YoloMetrics>     m_metricsQueue;
+        std::mutex                  m_metricsMutex;
+        std::condition_variable     m_metricsCondition;
+        std::vector<std::string>    m_classNames;
         const std::set<std::string> m_modelNames = {"yolov4", "yolov3", "tiny_yolov4", "tiny_yolov3", "enet_b0_yolov3"};
 };
 
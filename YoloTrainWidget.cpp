@@ -27,28 +27,93 @@ void CYoloTrainWidget::init()
     m_pComboModel->addItem("enet_b0_yolov3");
     m_pComboModel->setCurrentText(QString::fromStdString(m_pParam->m_cfg["model"]));
 
+    m_pComboEngine = addCombo(tr("Training engine"));
+    m_pComboEngine->addItem("process");
+#ifdef TRAINYOLO_WITH_LIBDARKNET
+    m_pComboEngine->addItem("library");
+#endif
+    m_pComboEngine->setCurrentText(QString::fromStdString(m_pParam->m_cfg["engine"]));
+
     m_pSpinWidth = addSpin("Input width", std::stoi(m_pParam->m_cfg["inputWidth"]), 1, 1024, 1);
     m_pSpinHeight = addSpin("Input height", std::stoi(m_pParam->m_cfg["inputHeight"]), 1, 1024, 1);
+    m_pCheckAllowCopy = addCheck("Copy dataset files if they can't be linked", std::stoi(m_pParam->m_cfg["allowCopy"]));
     m_pSpinTrainEvalRatio = addDoubleSpin("Train/Eval split ratio", std::stod(m_pParam->m_cfg["splitRatio"]), 0.1, 0.9, 0.1, 1);
     m_pSpinBatchSize = addSpin("Batch size", std::stoi(m_pParam->m_cfg["batchSize"]), 1, 64, 1);
     m_pSpinLr = addDoubleSpin("Learning rate", std::stod(m_pParam->m_cfg["learningRate"]), 0.0001, 0.1, 0.001, 4);
     m_pSpinMomentum =  addDoubleSpin("Momentum", std::stod(m_pParam->m_cfg["momentum"]), 0.0, 1.0, 0.01, 2);
     m_pSpinDecay = addDoubleSpin("Weight decay", std::stod(m_pParam->m_cfg["weightDecay"]), 0.0, 1.0, 0.0001, 4);
     m_pSpinSubdivision = addSpin("Subdivision", std::stoi(m_pParam->m_cfg["subdivision"]), 4, 64, 2);
+    m_pComboScheduleMode = addCombo(tr("Iterations budget"));
+    m_pComboScheduleMode->addItem("classes");
+    m_pComboScheduleMode->addItem("dataset");
+    m_pComboScheduleMode->setCurrentText(QString::fromStdString(m_pParam->m_cfg["scheduleMode"]));
+    m_pSpinTrainPasses = addDoubleSpin("Passes over training set", std::stod(m_pParam->m_cfg["trainPasses"]), 0.1, 10000.0, 10.0, 1);
+    m_pSpinTrainPasses->setEnabled(m_pParam->m_cfg["scheduleMode"] == "dataset");
+    m_pComboLrPolicy = addCombo(tr("Learning rate policy"));
+    m_pComboLrPolicy->addItem("steps");
+    m_pComboLrPolicy->addItem("cosine");
+    m_pComboLrPolicy->addItem("one_cycle");
+    m_pComboLrPolicy->setCurrentText(QString::fromStdString(m_pParam->m_cfg["lrPolicy"]));
     m_pCheckAutoConfig = addCheck("Auto configuration", std::stoi(m_pParam->m_cfg["autoConfig"]));
     m_pBrowseFile = addBrowseFile("Configuration file path", QString::fromStdString(m_pParam->m_cfg["configPath"]), "Select configuration file");
     m_pBrowseFile->setEnabled(std::stoi(m_pParam->m_cfg["autoConfig"]) == false);
     m_pBrowseOutFolder = addBrowseFolder("Output folder", QString::fromStdString(m_pParam->m_cfg["outputPath"]), "Select output folder");
+    m_pSpinEvalPeriod = addSpin("mAP evaluation period (epochs)", std::stoi(m_pParam->m_cfg["evalPeriod"]), 1, 1000, 1);
+    m_pSpinEvalSubsetSize = addSpin("mAP evaluation images (0 = all)", std::stoi(m_pParam->m_cfg["evalSubsetSize"]), 0, 1000000, 100);
+    m_pCheckNativeEval = addCheck("Native mAP evaluation (CPU)", std::stoi(m_pParam->m_cfg["nativeEval"]));
+    m_pSpinEvalWorkers = addSpin("Evaluation workers (0 = auto)", std::stoi(m_pParam->m_cfg["evalWorkers"]), 0, 256, 1);
+    m_pSpinEvalWorkers->setEnabled(std::stoi(m_pParam->m_cfg["nativeEval"]));
+
+    bool bSelectBest = std::stoi(m_pParam->m_cfg["selectBest"]);
+    m_pCheckSelectBest = addCheck("Select best checkpoint", bSelectBest);
+    m_pComboSelectionMetric = addCombo(tr("Selection metric"));
+    m_pComboSelectionMetric->addItem("mAP50");
+    m_pComboSelectionMetric->addItem("mAP50-95");
+    m_pComboSelectionMetric->setCurrentText(QString::fromStdString(m_pParam->m_cfg["selectionMetric"]));
+    m_pSpinLatencyBudget = addDoubleSpin("Latency budget (ms, 0 = none)", std::stod(m_pParam->m_cfg["latencyBudget"]), 0.0, 10000.0, 1.0, 1);
+    m_pSpinSelectionWorkers = addSpin("Models in memory", std::stoi(m_pParam->m_cfg["selectionWorkers"]), 1, 64, 1);
+    m_pComboSelectionMetric->setEnabled(bSelectBest);
+    m_pSpinLatencyBudget->setEnabled(bSelectBest);
+    m_pSpinSelectionWorkers->setEnabled(bSelectBest);
+    m_pSpinPruneRatio = addDoubleSpin("Pruning FLOPs reduction (0 = none)", std::stod(m_pParam->m_cfg["pruneRatio"]), 0.0, 0.9, 0.05, 2);
+    m_pSpinPruneIterations = addSpin("Pruning fine-tune iterations", std::stoi(m_pParam->m_cfg["pruneFinetuneIterations"]), 0, 1000000, 100);
+    m_pSpinPruneIterations->setEnabled(std::stod(m_pParam->m_cfg["pruneRatio"]) > 0);
+    m_pCheckExportOnnx = addCheck("Export ONNX model", std::stoi(m_pParam->m_cfg["exportOnnx"]));
+    m_pSpinOnnxCheckImages = addSpin("ONNX check images (0 = none)", std::stoi(m_pParam->m_cfg["onnxCheckImages"]), 0, 1000, 1);
+    m_pSpinOnnxCheckImages->setEnabled(std::stoi(m_pParam->m_cfg["exportOnnx"]));
 
     connect(m_pCheckAutoConfig, &QCheckBox::stateChanged, [&](int state)
     {
         m_pBrowseFile->setEnabled(state == false);
     });
+    connect(m_pComboScheduleMode, &QComboBox::currentTextChanged, [&](const QString& text)
+    {
+        m_pSpinTrainPasses->setEnabled(text == "dataset");
+    });
+    connect(m_pCheckNativeEval, &QCheckBox::stateChanged, [&](int state)
+    {
+        m_pSpinEvalWorkers->setEnabled(state != 0);
+    });
+    connect(m_pCheckSelectBest, &QCheckBox::stateChanged, [&](int state)
+    {
+        m_pComboSelectionMetric->setEnabled(state != 0);
+        m_pSpinLatencyBudget->setEnabled(state != 0);
+        m_pSpinSelectionWorkers->setEnabled(state != 0);
+    });
+    connect(m_pSpinPruneRatio, QOverload<double>::of(&QDoubleSpinBox::valueChanged), [&](double value)
+    {
+        m_pSpinPruneIterations->setEnabled(value > 0);
+    });
+    connect(m_pCheckExportOnnx, &QCheckBox::stateChanged, [&](int state)
+    {
+        m_pSpinOnnxCheckImages->setEnabled(state != 0);
+    });
 }
 
 void CYoloTrainWidget::onApply()
 {
     m_pParam->m_cfg["model"] = m_pComboModel->currentText().toStdString();
+    m_pParam->m_cfg["engine"] = m_pComboEngine->currentText().toStdString();
     m_pParam->m_cfg["subdivision"] = std::to_string(m_pSpinSubdivision->value());
     m_pParam->m_cfg["inputWidth"] = std::to_string(m_pSpinWidth->value());
     m_pParam->m_cfg["inputHeight"] = std::to_string(m_pSpinHeight->value());
@@ -57,8 +122,24 @@ void CYoloTrainWidget::onApply()
     m_pParam->m_cfg["learningRate"] = std::to_string(m_pSpinLr->value());
     m_pParam->m_cfg["momentum"] = std::to_string(m_pSpinMomentum->value());
     m_pParam->m_cfg["weightDecay"] = std::to_string(m_pSpinDecay->value());
+    m_pParam->m_cfg["scheduleMode"] = m_pComboScheduleMode->currentText().toStdString();
+    m_pParam->m_cfg["trainPasses"] = std::to_string(m_pSpinTrainPasses->value());
+    m_pParam->m_cfg["lrPolicy"] = m_pComboLrPolicy->currentText().toStdString();
     m_pParam->m_cfg["autoConfig"] = std::to_string(m_pCheckAutoConfig->isChecked());
+    m_pParam->m_cfg["allowCopy"] = std::to_string(m_pCheckAllowCopy->isChecked());
     m_pParam->m_cfg["configPath"] = m_pBrowseFile->getPath().toStdString();
     m_pParam->m_cfg["outputPath"] = m_pBrowseOutFolder->getPath().toStdString();
+    m_pParam->m_cfg["evalPeriod"] = std::to_string(m_pSpinEvalPeriod->value());
+    m_pParam->m_cfg["evalSubsetSize"] = std::to_string(m_pSpinEvalSubsetSize->value());
+    m_pParam->m_cfg["nativeEval"] = std::to_string(m_pCheckNativeEval->isChecked());
+    m_pParam->m_cfg["evalWorkers"] = std::to_string(m_pSpinEvalWorkers->value());
+    m_pParam->m_cfg["selectBest"] = std::to_string(m_pCheckSelectBest->isChecked());
+    m_pParam->m_cfg["selectionMetric"] = m_pComboSelectionMetric->currentText().toStdString();
+    m_pParam->m_cfg["latencyBudget"] = std::to_string(m_pSpinLatencyBudget->value());
+    m_pParam->m_cfg["selectionWorkers"] = std::to_string(m_pSpinSelectionWorkers->value());
+    m_pParam->m_cfg["pruneRatio"] = std::to_string(m_pSpinPruneRatio->value());
+    m_pParam->m_cfg["pruneFinetuneIterations"] = std::to_string(m_pSpinPruneIterations->value());
+    m_pParam->m_cfg["exportOnnx"] = std::to_string(m_pCheckExportOnnx->isChecked());
+    m_pParam->m_cfg["onnxCheckImages"] = std::to_string(m_pSpinOnnxCheckImages->value());
     emit doApplyProcess(m_pParam);
 }
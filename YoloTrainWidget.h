@@ -33,7 +33,24 @@ class YOLOTRAIN_EXPORT CYoloTrainWidget: public CWorkflowTaskWidget
         QSpinBox*           m_pSpinBatchSize = nullptr;
         QSpinBox*           m_pSpinSubdivision = nullptr;
         QComboBox*          m_pComboModel = nullptr;
+        QComboBox*          m_pComboEngine = nullptr;
         QCheckBox*          m_pCheckAutoConfig = nullptr;
+        QCheckBox*          m_pCheckAllowCopy = nullptr;
+        QComboBox*          m_pComboScheduleMode = nullptr;
+        QDoubleSpinBox*     m_pSpinTrainPasses = nullptr;
+        QComboBox*          m_pComboLrPolicy = nullptr;
+        QSpinBox*           m_pSpinEvalPeriod = nullptr;
+        QSpinBox*           m_pSpinEvalSubsetSize = nullptr;
+        QCheckBox*          m_pCheckNativeEval = nullptr;
+        QSpinBox*           m_pSpinEvalWorkers = nullptr;
+        QCheckBox*          m_pCheckSelectBest = nullptr;
+        QComboBox*          m_pComboSelectionMetric = nullptr;
+        QDoubleSpinBox*     m_pSpinLatencyBudget = nullptr;
+        QSpinBox*           m_pSpinSelectionWorkers = nullptr;
+        QDoubleSpinBox*     m_pSpinPruneRatio = nullptr;
+        QSpinBox*           m_pSpinPruneIterations = nullptr;
+        QCheckBox*          m_pCheckExportOnnx = nullptr;
+        QSpinBox*           m_pSpinOnnxCheckImages = nullptr;
         CBrowseFileWidget*  m_pBrowseFile = nullptr;
         CBrowseFileWidget*  m_pBrowseOutFolder = nullptr;
 };
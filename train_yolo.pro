@@ -28,20 +28,40 @@ DEFINES += QT_DEPRECATED_WARNINGS
 include(../../../IkomiaCore/IkomiaPluginsCpp.pri)
 
 HEADERS += \
+    DarknetConfig.h \
+    DarknetModel.h \
+    YoloEvaluator.h \
+    YoloOnnxExporter.h \
+    YoloPruner.h \
     YoloTrain.hpp \
     YoloTrainGlobal.hpp \
     YoloTrainProcess.h \
     YoloTrainWidget.h
 
 SOURCES += \
+    DarknetConfig.cpp \
+    DarknetModel.cpp \
+    YoloEvaluator.cpp \
+    YoloOnnxExporter.cpp \
+    YoloPruner.cpp \
     YoloTrainProcess.cpp \
     YoloTrainWidget.cpp
 
 # OpenCV
-win32:CONFIG(release, debug|release): LIBS += -lopencv_core$${OPENCV_VERSION} -lopencv_imgproc$${OPENCV_VERSION} -lopencv_dnn$${OPENCV_VERSION}
-else:win32:CONFIG(debug, debug|release): LIBS += -lopencv_core$${OPENCV_VERSION}d -lopencv_imgproc$${OPENCV_VERSION}d -lopencv_dnn$${OPENCV_VERSION}d
-unix:!macx: LIBS += -lopencv_core -lopencv_imgproc -lopencv_dnn
-macx: LIBS += -lopencv_core.$${OPENCV_VERSION} -lopencv_imgproc.$${OPENCV_VERSION} -lopencv_dnn.$${OPENCV_VERSION}
+win32:CONFIG(release, debug|release): LIBS += -lopencv_core$${OPENCV_VERSION} -lopencv_imgproc$${OPENCV_VERSION} -lopencv_imgcodecs$${OPENCV_VERSION} -lopencv_dnn$${OPENCV_VERSION}
+else:win32:CONFIG(debug, debug|release): LIBS += -lopencv_core$${OPENCV_VERSION}d -lopencv_imgproc$${OPENCV_VERSION}d -lopencv_imgcodecs$${OPENCV_VERSION}d -lopencv_dnn$${OPENCV_VERSION}d
+unix:!macx: LIBS += -lopencv_core -lopencv_imgproc -lopencv_imgcodecs -lopencv_dnn
+macx: LIBS += -lopencv_core.$${OPENCV_VERSION} -lopencv_imgproc.$${OPENCV_VERSION} -lopencv_imgcodecs.$${OPENCV_VERSION} -lopencv_dnn.$${OPENCV_VERSION}
+
+# In-process darknet engine: qmake CONFIG+=libdarknet
+libdarknet {
+DEFINES += TRAINYOLO_WITH_LIBDARKNET
+HEADERS += DarknetEngine.h
+SOURCES += DarknetEngine.cpp
+INCLUDEPATH += $$PWD/../../../darknet/include
+win32: LIBS += -L$$PWD/../../../darknet -ldark
+unix: LIBS += -L$$PWD/../../../darknet/buildDarknet -ldarknet
+}
 
 # Ikomia libs
 LIBS += $$link_utils()